@@ -47,6 +47,12 @@
 	#define UNROLL
 #endif
 
+//Compile the function once per instruction set, and pick the best version the CPU supports when the program starts
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__) && (__GNUC__ >= 6)
+	#define MULTIVERSION __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+	#define MULTIVERSION
+#endif
 
 
 #endif /* ATTRIBUTES_HPP_ */
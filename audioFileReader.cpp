@@ -1,10 +1,56 @@
 #include "audioFileReader.hpp"
 
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <unistd.h>
+#include <ctime>
 #include <stdexcept>
+#include <algorithm>
+#include <cmath>
 
-static const unsigned NO_REQUEST = 0xffffffff;
+#include "sampleKernels.hpp"
 
-AudioFileReader::AudioFileReader(const char *fname, unsigned maxRequestMilliseconds, unsigned maxRememberSeconds, unsigned maxPreloadSeconds) {
+static const uint64_t NO_REQUEST = UINT64_MAX;
+static const int64_t NO_DEADLINE = INT64_MAX;
+static const int PLAYBACK_CURSOR = 0;
+
+// How long the stretcher's worker waits before looking again when it can't do anything
+static const int STRETCH_POLL_MILLISECONDS = 5;
+static const int PRERENDER_POLL_MILLISECONDS = 20;
+
+// Marks that the stretcher has no speed change waiting
+static const uint64_t NO_SPEED_CHANGE = UINT64_MAX;
+
+INLINE static int64_t nanosecondsOf(std::chrono::steady_clock::time_point time) {
+	return (int64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+/*
+ * A file is only taken to be a recording if it was changed in the last few seconds and is
+ * written to again while we watch it for a moment. A file that was just saved or copied isn't.
+ */
+bool AudioFileReader::isBeingRecorded(const char *fname) {
+	struct stat info;
+	if (stat(fname, &info) != 0 || !S_ISREG(info.st_mode)) return false;
+	if (time(NULL) - info.st_mtime > RECORDING_IDLE_SECONDS) return false;
+
+	const int probeFd = inotify_init1(IN_CLOEXEC);
+	if (probeFd >= 0 && inotify_add_watch(probeFd, fname, IN_MODIFY) >= 0) {
+		pollfd probe = { probeFd, POLLIN, 0 };
+		const bool written = (poll(&probe, 1, RECORDING_PROBE_MILLISECONDS) > 0);
+		close(probeFd);
+		return written;
+	}
+	if (probeFd >= 0) close(probeFd);
+
+	//without inotify, see if it grows
+	std::this_thread::sleep_for(std::chrono::milliseconds(RECORDING_PROBE_MILLISECONDS));
+	struct stat later;
+	return (stat(fname, &later) == 0 && later.st_size != info.st_size);
+}
+
+AudioFileReader::AudioFileReader(const char *fname, unsigned maxRequestMilliseconds, unsigned maxRememberSeconds, unsigned maxPreloadSeconds, unsigned maxCacheMegabytes, bool compactHistory, unsigned maxArchiveMegabytes, ChannelMode channelMode, bool recording, unsigned outputRate, StretchEngine stretchEngine, StretchQuality stretchQuality) {
 	alive = true;
 	error = 0;
 
@@ -12,177 +58,1469 @@ AudioFileReader::AudioFileReader(const char *fname, unsigned maxRequestMilliseco
 	filename = new char[chars];
 	std::memcpy(filename, fname, chars);
 
-	audioFile = sox_open_read(fname, NULL, NULL, NULL);
+	//A recording that is still being made grows while we play it, so it's decoded by SoX as it arrives
+	tailing = recording;
+	watchFd = -1;
+	watchedSize = 0;
+	tailBytes = 0;
+	tailPending = tailing;
+	writerClosed = false;
+	lastGrowth = std::chrono::steady_clock::now();
+	recordingEnded = false;
 
-	if (audioFile == NULL || audioFile->encoding.encoding == SOX_ENCODING_UNKNOWN) {
-		throw std::invalid_argument("Error: Unable to decode audio. Either the file is corrupt or you have not installed the codecs required to play it. Install the libsox-fmt-all package, then restart OpenScribe and try again.");
-	} else if (!audioFile->seekable) {
-		throw std::invalid_argument("Error: Sox is unable to seek in this file. Aborting.");
+	//Uncompressed files are read directly from a memory mapping. Everything else is decoded by SoX.
+	sox_format_t *audioFile = NULL;
+	sox_signalinfo_t signal;
+	lengthPending = false;
+	pcmFile = tailing ? NULL : PcmFileMap::open(fname);
+	//The mapping is read in the audio callback, which has no time to resample, so files at another rate are decoded like the rest
+	if (pcmFile != NULL && outputRate != 0 && pcmFile->getSampleRate() != outputRate) {
+		delete pcmFile;
+		pcmFile = NULL;
 	}
+	//MP3, FLAC, and Ogg files are indexed in the background so that seeks can jump straight to the right frame
+	seekIndex = (pcmFile == NULL && !tailing) ? SeekIndex::open(fname) : NULL;
+	if (pcmFile != NULL) {
+		fileInfo.sampleRate = pcmFile->getSampleRate();
+		fileInfo.numChannels = pcmFile->getNumChannels();
+		numSamples = pcmFile->getNumSamples();
+	} else if (seekIndex != NULL && Decoder::probe(fname, seekIndex->getFileType(), signal)) {
+		//Indexed files only have their header read, so opening a long MP3 file doesn't wait for SoX to scan all of it
+		fileInfo.sampleRate = (unsigned) signal.rate;
+		fileInfo.numChannels = signal.channels;
+		numSamples = signal.length;
 
-	fileInfo.sampleRate = (unsigned) audioFile->signal.rate;
-	fileInfo.numChannels = audioFile->signal.channels;
-	fileInfo.numSamples = audioFile->signal.length;
+		//If the header doesn't give the length, guess it until the index has the exact value
+		if (numSamples == 0) {
+			lengthPending = !seekIndex->isReady();
+			numSamples = (lengthPending ? seekIndex->estimateFrames() : seekIndex->getTotalFrames()) * fileInfo.numChannels;
+		}
+	} else {
+		audioFile = sox_open_read(fname, NULL, NULL, NULL);
+
+		if (audioFile == NULL || audioFile->encoding.encoding == SOX_ENCODING_UNKNOWN) {
+			if (audioFile != NULL) sox_close(audioFile);
+			delete seekIndex;
+			throw std::invalid_argument("Error: Unable to decode audio. Either the file is corrupt or you have not installed the codecs required to play it. Install the libsox-fmt-all package, then restart OpenScribe and try again.");
+		} else if (!audioFile->seekable) {
+			sox_close(audioFile);
+			delete seekIndex;
+			throw std::invalid_argument("Error: Sox is unable to seek in this file. Aborting.");
+		}
 
-	if (fileInfo.numSamples >= 0xffffffff) {
-		throw std::invalid_argument("Error: File is too big! OpenScribe cannot read audio files with more than 4GB of samples. What are you even trying to play?!?");
+		fileInfo.sampleRate = (unsigned) audioFile->signal.rate;
+		fileInfo.numChannels = audioFile->signal.channels;
+		numSamples = audioFile->signal.length;
+	}
+
+	//Recordings with one speaker on each channel, or the same audio on both, can be played as mono
+	sourceChannels = fileInfo.numChannels;
+	sourceSamples = numSamples;
+	const unsigned sourceRate = fileInfo.sampleRate;
+	this->channelMode = (sourceChannels > 1) ? channelMode : ALL_CHANNELS;
+	if (this->channelMode != ALL_CHANNELS) {
+		fileInfo.numChannels = 1;
+		numSamples = sourceSamples / sourceChannels;
+	}
+
+	//Decoded audio is converted to the sound server's rate ahead of time, so it doesn't have to resample it in real time
+	resampler = (pcmFile == NULL && outputRate != 0 && !tailing) ? Resampler::create(fileInfo.sampleRate, outputRate, fileInfo.numChannels) : NULL;
+	if (resampler != NULL) {
+		numSamples = resampler->outputFrames(numSamples / fileInfo.numChannels) * fileInfo.numChannels;
+		fileInfo.sampleRate = outputRate;
 	}
 
 	MAX_REQUEST = (unsigned) ((double) maxRequestMilliseconds * (double) fileInfo.sampleRate * (double) fileInfo.numChannels / 1000.0 + 0.5);
 	MAX_REQUEST -= MAX_REQUEST % fileInfo.numChannels;
 
 	if (MAX_REQUEST == 0) {
+		if (audioFile != NULL) sox_close(audioFile);
+		delete seekIndex;
 		throw std::invalid_argument("Error: Sample rate is invalid or could not be determined.");
 	}
+	numFrames = numSamples / fileInfo.numChannels;
 
-	MAX_PRE = maxRememberSeconds * fileInfo.sampleRate * fileInfo.numChannels;
-	MAX_POST = MAX_REQUEST + maxPreloadSeconds * fileInfo.sampleRate * fileInfo.numChannels;
-	BUFFER_SIZE = MAX_PRE + MAX_POST;
-
-	circleBuffer = new float[BUFFER_SIZE + MAX_REQUEST];
-	toConvert = new int[MAX_REQUEST];
 	nil = new float[MAX_REQUEST];
 	std::memset(nil, 0, MAX_REQUEST * sizeof(float));
 
-	preValid = postValid = pos = 0;
+	windowSequence = 0;
+	windowStart = 0;
+	windowEnd = 0;
+	claimWaiting = false;
+	pos = 0;
+	claim = NO_REQUEST;
 	requestingReset = NO_REQUEST;
+	pollInterval = std::chrono::milliseconds(maxRequestMilliseconds / 2 + 1);
+	hotStart = false;
+	hotBuffer = NULL;
+	compactBuffer = NULL;
+	converted = (this->channelMode != ALL_CHANNELS) ? new float[MAX_REQUEST] : NULL;
+	pendingJump = NO_REQUEST;
+	jumpHits = 0;
+	jumpMisses = 0;
+
+	for (int i = 0; i < MAX_CURSORS; i++) {
+		cursors[i].name = NULL;
+		cursors[i].inUse = false;
+		cursors[i].position = 0;
+		cursors[i].lookahead = 0;
+		cursors[i].deadline = NO_DEADLINE;
+		cursors[i].samplesPerSecond = (float) (fileInfo.sampleRate * fileInfo.numChannels);
+		cursors[i].stride = 0;
+	}
+	cursors[PLAYBACK_CURSOR].name = "playback";
+	cursors[PLAYBACK_CURSOR].inUse = true;
+
+	if (pcmFile != NULL) {
+		//Converting straight from the mapping is cheap enough to do in the audio callback, so there's no need for a preloader
+		scratch = new float[toSource(MAX_REQUEST)];
+		DECODE_BATCH = MAX_REQUEST;
+		//there's no ring and no segments either
+		MAX_PRE = 0;
+		MAX_POST = 0;
+		BUFFER_SIZE = 0;
+		BUFFER_MASK = 0;
+		SEGMENT_SIZE = 0;
+		ringMemory = NULL;
+		circleBuffer = NULL;
+		pcmCache = NULL;
+		//the callback reads the mapping directly, so it must never be the one to wait on the disk
+		readAhead = ReadAhead::open(fname, (size_t) READ_AHEAD_MEGABYTES << 20);
+		mapStream = (readAhead != NULL) ? readAhead->attach() : -1;
+		decoder = NULL;
+		segmentCache = NULL;
+		archive = NULL;
+		jobs = NULL;
+		numJobs = 0;
+		parallelDecoding = false;
+		readerThread = NULL;
+	} else {
+		//The decoder works in large batches no matter how small the requests from the audio callback are
+		DECODE_BATCH = (unsigned) ((double) DECODE_BATCH_MILLISECONDS * (double) fileInfo.sampleRate * (double) fileInfo.numChannels / 1000.0 + 0.5);
+		DECODE_BATCH -= DECODE_BATCH % fileInfo.numChannels;
+		if (DECODE_BATCH < MAX_REQUEST) DECODE_BATCH = MAX_REQUEST;
+
+		MAX_PRE = maxRememberSeconds * fileInfo.sampleRate * fileInfo.numChannels;
+		MAX_POST = MAX_REQUEST + maxPreloadSeconds * fileInfo.sampleRate * fileInfo.numChannels;
+		if (MAX_POST < MAX_REQUEST + DECODE_BATCH) MAX_POST = MAX_REQUEST + DECODE_BATCH;
+
+		//The ring is rounded up to a power of two. Any extra space goes towards remembering more history.
+		const size_t sampleBytes = compactHistory ? sizeof(int16_t) : sizeof(float);
+		ringMemory = new MirroredBuffer((MAX_PRE + MAX_POST) * sampleBytes);
+		BUFFER_SIZE = (unsigned) (ringMemory->size() / sampleBytes);
+		BUFFER_MASK = BUFFER_SIZE - 1;
+		MAX_PRE = BUFFER_SIZE - MAX_POST;
+		scratch = new float[DECODE_BATCH];
+		if (compactHistory) {
+			circleBuffer = NULL;
+			compactBuffer = (int16_t*) ringMemory->data();
+			if (converted == NULL) converted = new float[MAX_REQUEST];
+		} else {
+			circleBuffer = (float*) ringMemory->data();
+		}
+
+		//Slow disks and network shares are read ahead of the decoders in the background, so they never wait on them
+		readAhead = ReadAhead::open(fname, (size_t) READ_AHEAD_MEGABYTES << 20);
+		mapStream = -1;
+		decoder = new Decoder(fname, audioFile, seekIndex, sourceChannels, lengthPending ? 0 : sourceSamples, this->channelMode, resampler, readAhead, DECODE_BATCH);
+
+		//Segments are about a second long, so the pre-roll each helper decodes after seeking is small in comparison
+		SEGMENT_SIZE = DECODE_BATCH * (fileInfo.sampleRate * fileInfo.numChannels / DECODE_BATCH + 1);
+
+		//Decoded audio is cached on disk, so once a file has been played through once we never need to decode it again.
+		//The cache always holds every channel, so it can be shared whichever channels are played, at the rate we play it at.
+		//It isn't used until the length of the file is known.
+		pcmCache = lengthFinal() ? PcmCache::open(fname, sourceRate, (resampler != NULL) ? outputRate : 0, sourceChannels, sourceSamples, (size_t) maxCacheMegabytes << 20) : NULL;
+
+		//Once the whole file is in the on-disk cache, there's nothing left to decode
+		segmentCache = (pcmCache == NULL || !pcmCache->isComplete()) ? SegmentCache::create(SEGMENT_SIZE, (size_t) SEGMENT_CACHE_MEGABYTES << 20) : NULL;
+		if (segmentCache != NULL) hotBuffer = new float[SEGMENT_SIZE];
+
+		//Chunks are also kept compressed, so skipping back a few minutes doesn't need the decoder either
+		archive = (segmentCache != NULL) ? HistoryArchive::create(SEGMENT_SIZE, fileInfo.numChannels, (size_t) maxArchiveMegabytes << 20) : NULL;
+
+		numJobs = 0;
+		if (seekIndex != NULL) {
+			const unsigned cores = std::thread::hardware_concurrency();
+			numJobs = (cores > 1) ? cores - 1 : 0;
+			if (numJobs > MAX_DECODER_THREADS) numJobs = MAX_DECODER_THREADS;
+		}
+		abortJobs = false;
+		parallelDecoding = (numJobs > 0);
+		jobs = (numJobs > 0) ? new DecodeJob[numJobs] : NULL;
+		for (unsigned i = 0; i < numJobs; i++) {
+			jobs[i].decoder = NULL;
+			jobs[i].start = 0;
+			jobs[i].end = 0;
+			jobs[i].done = 0;
+			jobs[i].stage = compactHistory ? new float[DECODE_BATCH] : NULL;
+			jobs[i].pending = false;
+			jobs[i].failed = false;
+			jobs[i].thread = new std::thread(&AudioFileReader::decoderLoop, this, &jobs[i]);
+		}
+
+		if (tailing) {
+			watchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+			if (watchFd >= 0 && inotify_add_watch(watchFd, fname, IN_MODIFY | IN_CLOSE_WRITE) < 0) {
+				close(watchFd);
+				watchFd = -1;
+			}
+		}
+
+		readerThread = new std::thread(&AudioFileReader::preloaderLoop, this);
+	}
 
-	readerThread = new std::thread(&AudioFileReader::preloaderLoop, this);
-	audioStretcher = new AudioStretcher(this);
+	audioStretcher = new AudioStretcher(this, stretchEngine, stretchQuality);
+	audioScrubber = new AudioScrubber(this);
 }
 
 AudioFileReader::~AudioFileReader() {
-	accessLock.lock();
+	//the stretcher's worker may be reading from us, so it goes first
+	delete audioStretcher;
+	delete audioScrubber;
+
+	waitLock.lock();
 	alive = false;
-	accessLock.unlock();
+	waitLock.unlock();
 	bufferMoved.notify_all();
-	readerThread->join();
+	claimReleased.notify_all();
+	if (readerThread != NULL) readerThread->join();
+
+	jobLock.lock();
+	jobLock.unlock();
+	jobReady.notify_all();
+	for (unsigned i = 0; i < numJobs; i++) {
+		jobs[i].thread->join();
+		delete jobs[i].thread;
+		delete jobs[i].decoder;
+		delete[] jobs[i].stage;
+	}
+	delete[] jobs;
+	if (watchFd >= 0) close(watchFd);
 
 	delete readerThread;
-	delete[] circleBuffer;
-	delete[] toConvert;
+	delete ringMemory;
+	delete decoder;
+	delete resampler;
+	delete readAhead;
+	delete segmentCache;
+	delete archive;
+	delete[] hotBuffer;
+	delete seekIndex;
+	delete[] scratch;
+	delete[] converted;
 	delete[] nil;
-	delete audioStretcher;
+	delete pcmCache;
+	delete pcmFile;
 	delete[] filename;
-
-	sox_close(audioFile);
 }
 
-const void *AudioFileReader::readData(unsigned at, size_t numBytes) {
+HOT const void *AudioFileReader::readData(uint64_t frame, size_t numBytes) {
 	assert(numBytes % sizeof(float) == 0);
 	register const size_t request = numBytes / sizeof(float);
-	if (at >= fileInfo.numSamples || !alive) return nil;
-	std::unique_lock<std::mutex> thisAccess(accessLock);
-	if (at >= preValid && (at + request <= postValid || (at + request > fileInfo.numSamples && postValid == fileInfo.numSamples))) {
-		//We already have the data ready in the buffer. Nothing needs to be done
-	} else if (at >= preValid && at <= postValid && postValid + request <= pos + MAX_POST) {
-		//The requested data is being read right now. Just wait for it.
-		readRequest.wait(thisAccess);
-	} else {
-		//We don't have the data yet, and it's not being read at this instant
-		requestingReset = at;
-		bufferMoved.notify_all();
-		resetRequest.wait(thisAccess);
+	const uint64_t at = frame * fileInfo.numChannels;
+	const uint64_t length = numSamples.load(std::memory_order_acquire);
+	if (at >= length || !alive) return nil;
+
+	const bool jumped = (at == pendingJump);
+	if (jumped) pendingJump = NO_REQUEST;
+
+	if (pcmFile != NULL) {
+		if (jumped) jumpHits.fetch_add(1, std::memory_order_relaxed);
+		if (readAhead != NULL) readAhead->update(mapStream, pcmFile->byteOffset(toSource(at)));
+		const float *samples = pcmFile->read(toSource(at), toSource(request), scratch);
+		if (channelMode == ALL_CHANNELS) return (const void*) samples;
+		mapChannels(converted, samples, request, sourceChannels, channelMode);
+		return (const void*) converted;
 	}
 
-	pos = at + request;
-	thisAccess.unlock();
-	bufferMoved.notify_all();
-	return (void*) &circleBuffer[at % BUFFER_SIZE];
+	//the audio after this request is needed as soon as this request is done playing
+	const double requestSeconds = (double) request / (double) (fileInfo.sampleRate * fileInfo.numChannels);
+	cursors[PLAYBACK_CURSOR].deadline.store(nanosecondsOf(std::chrono::steady_clock::now()) + (int64_t) (1e9 * requestSeconds), std::memory_order_relaxed);
+
+	//if the data is in the on-disk cache, we can read it straight from there
+	if (pcmCache != NULL) {
+		const float *cached = getCached(at, (unsigned) request);
+		if (cached != NULL) {
+			setClaim(NO_REQUEST);
+			pos.store(at + request, std::memory_order_release);
+			if (jumped) jumpHits.fetch_add(1, std::memory_order_relaxed);
+			if (channelMode == ALL_CHANNELS) return (const void*) cached;
+			mapChannels(converted, cached, request, sourceChannels, channelMode);
+			return (const void*) converted;
+		}
+	}
+
+	//claim the data before checking that it is valid, so the preloader knows not to overwrite it while we use it
+	setClaim(at);
+	uint64_t preValid, postValid;
+	loadWindow(preValid, postValid);
+
+	if (at >= preValid && (at + request <= postValid || (at + request > length && postValid == length))) {
+		//We already have the data ready in the buffer. Only wake the preloader if it has room to read a whole batch
+		pos.store(at + request, std::memory_order_release);
+		if (postValid < length && postValid + DECODE_BATCH <= at + request + MAX_POST) bufferMoved.notify_one();
+		if (jumped) jumpHits.fetch_add(1, std::memory_order_relaxed);
+		return (const void*) ringSamples(at, (unsigned) request, converted);
+	}
+
+	//We don't have the data yet. Don't wait for it- the caller can play silence until it is ready
+	setClaim(NO_REQUEST);
+	if (jumped) jumpMisses.fetch_add(1, std::memory_order_relaxed);
+	if (at < preValid || at > postValid) {
+		//It's not being read at this instant either
+		requestingReset.store(at, std::memory_order_release);
+	}
+	pos.store(at + request, std::memory_order_release);
+	bufferMoved.notify_one();
+	return NULL;
+}
+
+void AudioFileReader::releaseData() {
+	setClaim(NO_REQUEST);
+}
+
+void AudioFileReader::jumpTo(uint64_t frame) {
+	const uint64_t position = frame * fileInfo.numChannels;
+	const uint64_t length = numSamples.load(std::memory_order_acquire);
+	//whatever was read last is for the old position
+	releaseData();
+	pendingJump = position;
+	if (pcmFile != NULL && readAhead != NULL && position < length) readAhead->update(mapStream, pcmFile->byteOffset(toSource(position)));
+	if (pcmFile != NULL || position >= length) return;
+
+	//if it's already in the buffer, there's nothing to do
+	uint64_t preValid, postValid;
+	loadWindow(preValid, postValid);
+	if (position >= preValid && position < postValid) return;
+
+	requestingReset.store(position, std::memory_order_release);
+	bufferMoved.notify_one();
+}
+
+void AudioFileReader::setHotOffsets(const std::vector<int> &offsets, bool includeStart) {
+	std::vector<int> sorted;
+	for (int offset : offsets) {
+		if (offset != 0) sorted.push_back(offset * (int) fileInfo.numChannels);
+	}
+	std::sort(sorted.begin(), sorted.end());
+	sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+	hotLock.lock();
+	hotOffsets = sorted;
+	hotStart = includeStart;
+	hotLock.unlock();
+	bufferMoved.notify_one();
+}
+
+int AudioFileReader::openCursor(const char *name) {
+	for (int i = 0; i < MAX_CURSORS; i++) {
+		bool unused = false;
+		if (cursors[i].inUse.compare_exchange_strong(unused, true)) {
+			cursors[i].name = name;
+			cursors[i].deadline.store(NO_DEADLINE, std::memory_order_relaxed);
+			cursors[i].stride.store(0, std::memory_order_relaxed);
+			cursors[i].lookahead.store(0, std::memory_order_release);
+			return i;
+		}
+	}
+	return -1;
+}
+
+void AudioFileReader::closeCursor(int cursor) {
+	if (cursor <= PLAYBACK_CURSOR || cursor >= MAX_CURSORS) return;
+	cursors[cursor].lookahead.store(0, std::memory_order_relaxed);
+	cursors[cursor].deadline.store(NO_DEADLINE, std::memory_order_relaxed);
+	cursors[cursor].inUse.store(false, std::memory_order_release);
+}
+
+void AudioFileReader::moveCursor(int cursor, uint64_t frame, unsigned lookahead, std::chrono::steady_clock::time_point deadline, float framesPerSecond) {
+	if (cursor <= PLAYBACK_CURSOR || cursor >= MAX_CURSORS) return;
+	const float samplesPerSecond = framesPerSecond * (float) fileInfo.numChannels;
+	cursors[cursor].position.store(frame * fileInfo.numChannels, std::memory_order_relaxed);
+	cursors[cursor].lookahead.store(lookahead * fileInfo.numChannels, std::memory_order_relaxed);
+	cursors[cursor].samplesPerSecond.store((samplesPerSecond > 1.f) ? samplesPerSecond : 1.f, std::memory_order_relaxed);
+	cursors[cursor].stride.store(0, std::memory_order_relaxed);
+	cursors[cursor].deadline.store(nanosecondsOf(deadline), std::memory_order_release);
+	bufferMoved.notify_one();
+}
+
+void AudioFileReader::moveScrubCursor(int cursor, uint64_t frame, int64_t strideFrames, unsigned reachFrames, std::chrono::steady_clock::time_point deadline, float framesPerSecond) {
+	if (cursor <= PLAYBACK_CURSOR || cursor >= MAX_CURSORS) return;
+	const float samplesPerSecond = framesPerSecond * (float) fileInfo.numChannels;
+	cursors[cursor].position.store(frame * fileInfo.numChannels, std::memory_order_relaxed);
+	cursors[cursor].lookahead.store(reachFrames * fileInfo.numChannels, std::memory_order_relaxed);
+	cursors[cursor].samplesPerSecond.store((samplesPerSecond > 1.f) ? samplesPerSecond : 1.f, std::memory_order_relaxed);
+	cursors[cursor].stride.store(strideFrames * (int64_t) fileInfo.numChannels, std::memory_order_relaxed);
+	cursors[cursor].deadline.store(nanosecondsOf(deadline), std::memory_order_release);
+	bufferMoved.notify_one();
+}
+
+void AudioFileReader::publishWindow(uint64_t preValid, uint64_t postValid, uint64_t writeFrom, unsigned writeCount) {
+	storeWindow(preValid, postValid);
+
+	/*
+	 * readData may have claimed data just before we shrank the window. If that data shares
+	 * space in the buffer with what we are about to read, wait until readData is done with it.
+	 */
+	uint64_t claimed;
+	while (alive && (claimed = claim.load()) != NO_REQUEST) {
+		const unsigned distance = (unsigned) ((claimed - writeFrom) & BUFFER_MASK);
+		if (distance >= writeCount && BUFFER_SIZE - distance >= MAX_REQUEST) break;
+
+		//readData wakes us when the claim changes, but it doesn't take the lock, so a wakeup can be missed. Don't wait long.
+		std::unique_lock<std::mutex> lock(waitLock);
+		claimWaiting.store(true);
+		if (alive && claim.load() == claimed) claimReleased.wait_for(lock, pollInterval);
+		claimWaiting.store(false, std::memory_order_relaxed);
+	}
 }
 
 HOT void AudioFileReader::preloaderLoop() {
-	unsigned head = 0;
+	std::unique_lock<std::mutex> idle(waitLock, std::defer_lock);
 	while (alive) {
-		std::unique_lock<std::mutex> thisAccess(accessLock);
+		//only this thread writes to the window, so it can't have changed since we last stored it
+		uint64_t preValid = windowStart.load(std::memory_order_relaxed);
+		uint64_t postValid = windowEnd.load(std::memory_order_relaxed);
 
-		//wait until we can read more data without overwriting what we want to keep or until a reset is requested
-		while (alive && requestingReset == NO_REQUEST && (postValid + MAX_REQUEST > pos + MAX_POST || postValid == fileInfo.numSamples)) bufferMoved.wait(thisAccess);
-		if (!alive) break;
+		if (lengthPending && seekIndex->isReady()) {
+			settleLength();
+			continue;
+		}
 
+		const uint64_t length = numSamples.load(std::memory_order_relaxed);
 		//handle reset requests
-		if (requestingReset != NO_REQUEST) {
-			preValid = postValid = pos = requestingReset;
-			readInto(requestingReset % BUFFER_SIZE, head);
-			postValid += MAX_REQUEST;
-
-			requestingReset = NO_REQUEST;
-			thisAccess.unlock();
-			resetRequest.notify_all();
+		const uint64_t reset = requestingReset.exchange(NO_REQUEST, std::memory_order_acquire);
+		if (reset != NO_REQUEST) {
+			publishWindow(reset, reset, reset, MAX_REQUEST);
+			decodeIntoRing(reset, MAX_REQUEST, decoder, scratch);
+
+			postValid = reset + MAX_REQUEST;
+			if (postValid > length) postValid = length;
+			storeWindow(reset, postValid);
+			rememberDecoded(reset, postValid);
+			continue;
+		}
+
+		//decode whatever is needed soonest
+		const bool bufferHasRoom = (postValid < length && postValid + DECODE_BATCH <= pos.load(std::memory_order_acquire) + MAX_POST);
+		unsigned chunk;
+		const Task task = nextTask(preValid, postValid, bufferHasRoom, chunk);
+		if (task == FILL_CACHE) {
+			decodeIntoCache(chunk, pos.load(std::memory_order_relaxed));
+			continue;
+		}
+
+		//wait until we can read more data without overwriting what we want to keep or until a reset is requested
+		if (task == IDLE) {
+			//the forward preload is safe, so use the time to fill in the history behind the last reset
+			if (tailing && postValid == length && followTail(preValid, postValid)) continue;
+			if (backfill(preValid, postValid)) continue;
+			if (warmHotTargets(preValid, postValid)) continue;
+
+			idle.lock();
+			if (alive && requestingReset.load(std::memory_order_relaxed) == NO_REQUEST) bufferMoved.wait_for(idle, pollInterval);
+			idle.unlock();
 			continue;
 		}
 
+		//if there's room for more than one segment, decode them in parallel
+		if (parallelDecoding && seekIndex->isReady() && !lengthPending) {
+			const unsigned room = (unsigned) (pos.load(std::memory_order_relaxed) + MAX_POST - postValid);
+			unsigned numSegments = room / SEGMENT_SIZE;
+			if (numSegments > numJobs + 1) numSegments = numJobs + 1;
+			while (numSegments > 1 && postValid + (uint64_t) (numSegments - 1) * SEGMENT_SIZE >= length) numSegments--;
+			if (numSegments > 1) {
+				decodeSegments(preValid, postValid, numSegments);
+				continue;
+			}
+		}
+
 		//read data into the buffer
-		if (postValid + MAX_REQUEST > preValid + BUFFER_SIZE) {
-			preValid = postValid + MAX_REQUEST - BUFFER_SIZE;
+		if (postValid + DECODE_BATCH > preValid + BUFFER_SIZE) {
+			preValid = postValid + DECODE_BATCH - BUFFER_SIZE;
+		}
+		publishWindow(preValid, postValid, postValid, DECODE_BATCH);
+		decodeIntoRing(postValid, DECODE_BATCH, decoder, scratch);
+
+		postValid += DECODE_BATCH;
+		if (postValid > length) postValid = length;
+		storeWindow(preValid, postValid);
+		rememberDecoded(preValid, postValid);
+	}
+}
+
+// Returns the end of the contiguous run of decoded data starting at from
+uint64_t AudioFileReader::decodedPrefix(uint64_t from, unsigned numSegments, uint64_t lastDone) const {
+	const uint64_t length = numSamples.load(std::memory_order_relaxed);
+	uint64_t prefix = from;
+	for (unsigned i = 0; i < numSegments; i++) {
+		const uint64_t segmentStart = from + (uint64_t) i * SEGMENT_SIZE;
+		prefix = (i + 1 < numSegments) ? jobs[i].done.load(std::memory_order_acquire) : lastDone;
+		if (prefix < segmentStart + SEGMENT_SIZE) break;
+	}
+	return (prefix > length) ? length : prefix;
+}
+
+/*
+ * Decodes numSegments segments starting at from into the buffer. The helper threads decode
+ * all but the last segment, and this thread decodes the last one so that the main decoder is
+ * left where the next read will continue from. The window grows as soon as each contiguous
+ * prefix is complete, so playback can start before the slower segments are done.
+ */
+void AudioFileReader::decodeSegments(uint64_t preValid, uint64_t from, unsigned numSegments) {
+	const uint64_t length = numSamples.load(std::memory_order_relaxed);
+	const uint64_t end = from + (uint64_t) numSegments * SEGMENT_SIZE;
+	if (end > preValid + BUFFER_SIZE) preValid = end - BUFFER_SIZE;
+	publishWindow(preValid, from, from, end - from);
+
+	abortJobs.store(false, std::memory_order_relaxed);
+	jobLock.lock();
+	for (unsigned i = 0; i + 1 < numSegments; i++) {
+		jobs[i].start = from + (uint64_t) i * SEGMENT_SIZE;
+		jobs[i].end = jobs[i].start + SEGMENT_SIZE;
+		jobs[i].done.store(jobs[i].start, std::memory_order_relaxed);
+		jobs[i].pending = true;
+	}
+	jobLock.unlock();
+	jobReady.notify_all();
+
+	uint64_t postValid = from;
+	uint64_t at = from + (uint64_t) (numSegments - 1) * SEGMENT_SIZE;
+	while (alive && at < end && at < length) {
+		if (requestingReset.load(std::memory_order_relaxed) != NO_REQUEST) {
+			abortJobs.store(true, std::memory_order_relaxed);
+			break;
 		}
-		thisAccess.unlock();
+		decodeIntoRing(at, DECODE_BATCH, decoder, scratch);
+		at += DECODE_BATCH;
 
-		unsigned i = postValid % BUFFER_SIZE;
-		if (postValid >= fileInfo.numSamples) {
-			std::memset((void*) &circleBuffer[i], 0, MAX_REQUEST * sizeof(float));
+		const uint64_t prefix = decodedPrefix(from, numSegments, at);
+		if (prefix > postValid) {
+			postValid = prefix;
+			storeWindow(preValid, postValid);
+		}
+	}
+	//if we stopped early, make sure the prefix doesn't run into the part we skipped
+	const uint64_t lastDone = (at < end && at < length) ? at : end;
+
+	//wait for the helpers to finish, growing the window as they go
+	std::unique_lock<std::mutex> lock(jobLock);
+	while (true) {
+		bool busy = false;
+		for (unsigned i = 0; i + 1 < numSegments; i++) busy |= jobs[i].pending;
+
+		const uint64_t prefix = decodedPrefix(from, numSegments, lastDone);
+		if (prefix > postValid) {
+			postValid = prefix;
+			storeWindow(preValid, postValid);
+		}
+
+		if (!busy || !alive) break;
+		if (requestingReset.load(std::memory_order_relaxed) != NO_REQUEST) abortJobs.store(true, std::memory_order_relaxed);
+		jobProgress.wait_for(lock, pollInterval);
+	}
+	bool failed = false;
+	for (unsigned i = 0; i + 1 < numSegments; i++) failed |= jobs[i].failed;
+	lock.unlock();
+
+	//a helper that couldn't open the file left a hole, so decode it here and don't use the helpers again
+	if (failed) {
+		parallelDecoding = false;
+		for (unsigned i = 0; i + 1 < numSegments && alive && !abortJobs.load(std::memory_order_relaxed); i++) {
+			const uint64_t segmentEnd = (jobs[i].end < length) ? jobs[i].end : length;
+			for (uint64_t next = jobs[i].done.load(std::memory_order_acquire); next < segmentEnd && alive; next += DECODE_BATCH) {
+				if (requestingReset.load(std::memory_order_relaxed) != NO_REQUEST) {
+					abortJobs.store(true, std::memory_order_relaxed);
+					break;
+				}
+				decodeIntoRing(next, DECODE_BATCH, decoder, scratch);
+				jobs[i].done.store(next + DECODE_BATCH, std::memory_order_release);
+			}
+			const uint64_t prefix = decodedPrefix(from, numSegments, lastDone);
+			if (prefix > postValid) {
+				postValid = prefix;
+				storeWindow(preValid, postValid);
+			}
+		}
+	}
+
+	rememberDecoded(preValid, postValid);
+}
+
+/*
+ * After a reset there is no history behind the playhead, so skipping back a little (such as
+ * when playback starts) would cause another reset. This decodes up to one segment of the
+ * history just behind preValid, in forward order so it only needs one seek, then lowers
+ * preValid to include it. Returns false if there is no more history to fill in.
+ */
+bool AudioFileReader::backfill(uint64_t preValid, uint64_t postValid) {
+	const uint64_t playhead = pos.load(std::memory_order_relaxed);
+	uint64_t lowest = (playhead > MAX_PRE) ? playhead - MAX_PRE : 0;
+
+	//don't fill in anything the next forward read would have to throw away again
+	if (postValid + DECODE_BATCH > lowest + BUFFER_SIZE) lowest = postValid + DECODE_BATCH - BUFFER_SIZE;
+	lowest += (fileInfo.numChannels - lowest % fileInfo.numChannels) % fileInfo.numChannels;
+	if (preValid <= lowest) return false;
+
+	const uint64_t from = (preValid - lowest > SEGMENT_SIZE) ? preValid - SEGMENT_SIZE : lowest;
+	for (uint64_t at = from; at < preValid; at += DECODE_BATCH) {
+		//a reset takes priority, and whatever we've done so far would be thrown away by it anyway
+		if (!alive || requestingReset.load(std::memory_order_relaxed) != NO_REQUEST) return true;
+
+		//None of this is in the window yet, so readData can't be using it. Just don't run into the valid data.
+		if (preValid - at >= DECODE_BATCH) {
+			decodeIntoRing(at, DECODE_BATCH, decoder, scratch);
 		} else {
-			readInto(i, head);
+			readInto(scratch, at, DECODE_BATCH, decoder);
+			storeRing(at, scratch, (unsigned) (preValid - at));
 		}
+	}
+
+	storeWindow(from, postValid);
+	rememberDecoded(from, postValid);
+	return true;
+}
+
+/*
+ * Replaces the estimated length with the exact one from the seek index. If the estimate was too
+ * long, the window is cut back to the real end of the file.
+ */
+void AudioFileReader::settleLength() {
+	lengthPending = false;
+	sourceSamples = (size_t) seekIndex->getTotalFrames() * sourceChannels;
+	decoder->setLength(sourceSamples);
 
-		thisAccess.lock();
-		postValid += MAX_REQUEST;
-		if (postValid > fileInfo.numSamples) postValid = fileInfo.numSamples;
-		thisAccess.unlock();
+	uint64_t length = fromSource(sourceSamples);
+	if (resampler != NULL) length = resampler->outputFrames(length / fileInfo.numChannels) * fileInfo.numChannels;
 
-		readRequest.notify_all();
+	uint64_t preValid = windowStart.load(std::memory_order_relaxed);
+	uint64_t postValid = windowEnd.load(std::memory_order_relaxed);
+	if (postValid > length) {
+		postValid = length;
+		if (preValid > postValid) preValid = postValid;
+		storeWindow(preValid, postValid);
 	}
+	setLength(length);
+	rememberDecoded(preValid, postValid);
 }
 
-HOT void AudioFileReader::readInto(unsigned index, unsigned &head) {
-	bool retry = false;
-	unsigned read = 0;
-	do {
-		if (head != postValid) {
-			//file head is not where we want to read- seek to it
-			sox_seek(audioFile, postValid, SOX_SEEK_SET);
-			head = postValid;
+// Returns true if the file has been written to (or closed by the recorder) since the last call
+bool AudioFileReader::fileChanged() {
+	if (watchFd >= 0) {
+		alignas(struct inotify_event) char events[4096];
+		bool changed = false;
+		ssize_t bytes;
+		while ((bytes = ::read(watchFd, events, sizeof(events))) > 0) {
+			changed = true;
+			for (ssize_t at = 0; at < bytes; at += (ssize_t) (sizeof(inotify_event) + ((const inotify_event*) &events[at])->len)) {
+				if ((((const inotify_event*) &events[at])->mask & IN_CLOSE_WRITE) != 0) writerClosed = true;
+			}
 		}
-		read = sox_read(audioFile, toConvert, MAX_REQUEST);
+		return changed;
+	}
+
+	struct stat info;
+	if (stat(filename, &info) != 0 || (size_t) info.st_size == watchedSize) return false;
+	watchedSize = (size_t) info.st_size;
+	return true;
+}
 
-		//SoX reads in signed 32-bit integer format, but I want floating point format. Convert it.
-		for (unsigned i = 0; i < read; i++) circleBuffer[index + i] = (float) ((double) toConvert[i] / (double) 0x80000000);
+/*
+ * Decodes whatever has been added to the end of a file that is still being recorded, and grows
+ * the file to include it. The buffer must have caught up with the end of the file. Returns false
+ * if there was nothing new to read.
+ */
+bool AudioFileReader::followTail(uint64_t preValid, uint64_t postValid) {
+	if (fileChanged()) tailPending = true;
+	if (!tailPending) {
+		if (std::chrono::steady_clock::now() - lastGrowth > std::chrono::seconds(RECORDING_IDLE_SECONDS)) endTail();
+		return false;
+	}
+	if (postValid + DECODE_BATCH > pos.load(std::memory_order_acquire) + MAX_POST) return false;
 
-		head += read;
-		if (head > fileInfo.numSamples) head = fileInfo.numSamples;
+	if (postValid + DECODE_BATCH > preValid + BUFFER_SIZE) {
+		preValid = postValid + DECODE_BATCH - BUFFER_SIZE;
+	}
+	publishWindow(preValid, postValid, postValid, DECODE_BATCH);
+	float *dest = (compactBuffer == NULL) ? &circleBuffer[postValid & BUFFER_MASK] : scratch;
+	const unsigned read = decoder->readMore(dest, postValid, DECODE_BATCH);
+	if (compactBuffer != NULL) storeRing(postValid, scratch, read);
+	storeWindow(preValid, postValid + read);
 
-		/*
-		 * When seeking to or from the end of an audio file, SoX will stop reading data from the file.
-		 * Until I find a better library, I'll work around this by closing the file and opening it again
-		 * If we immediately fail again, then an actual error occurred.
-		 */
-		if (read == 0 && postValid < fileInfo.numSamples) {
-			if (retry) {
-				//Okay, something actually went wrong here
+	struct stat info;
+	const size_t size = (stat(filename, &info) == 0) ? (size_t) info.st_size : 0;
+	if (read == 0) {
+		//Caught up with the recording, so wait for it to change again. If it grew a lot and SoX still found nothing, SoX is stuck.
+		tailPending = false;
+		if (size > tailBytes + TAIL_STALL_BYTES) {
+			if (!decoder->restart(postValid)) {
 				error = 1;
 				alive = false;
-				std::memset((void*) &circleBuffer[index], 0, MAX_REQUEST * sizeof(float));
-				return;
 			}
+			tailBytes = size;
+			tailPending = true;
+		} else if (writerClosed) {
+			endTail();
+		}
+		return false;
+	}
+	tailBytes = size;
+	lastGrowth = std::chrono::steady_clock::now();
+	postValid += read;
 
-			// "have you tried turning it off and on again?"
-			sox_close(audioFile);
-			audioFile = sox_open_read(filename, NULL, NULL, NULL);
-			sox_seek(audioFile, postValid, SOX_SEEK_SET);
-
-			head = postValid;
-			retry = true;
-		} else break;
-	} while (true);
-
-	if (read < MAX_REQUEST) std::memset((void*) &circleBuffer[index + read], 0, (MAX_REQUEST - read)*sizeof(float));
-
-	// wrap around
-	if (index + MAX_REQUEST > BUFFER_SIZE) {
-		// end -> start
-		std::memcpy((void*) circleBuffer, (void*) &circleBuffer[BUFFER_SIZE], (index + MAX_REQUEST - BUFFER_SIZE)*sizeof(float));
-	} else if (index < MAX_REQUEST) {
-		// start -> end
-		std::memcpy((void*) &circleBuffer[BUFFER_SIZE + index], (void*) &circleBuffer[index], (MAX_REQUEST - index)*sizeof(float));
+	//readData checks the length before the window, so the length is grown last
+	setLength(postValid);
+	rememberDecoded(preValid, postValid);
+	return true;
+}
+
+// Stops following a recording that is finished. Whatever has been read of it so far is its length.
+void AudioFileReader::endTail() {
+	tailing = false;
+	tailPending = false;
+	if (watchFd >= 0) {
+		close(watchFd);
+		watchFd = -1;
+	}
+	recordingEnded.store(true, std::memory_order_relaxed);
+}
+
+/*
+ * Makes sure the audio at one of the hot jump targets is in the segment cache, so that jumping
+ * there only has to copy it back into the buffer. Returns false if every target is already ready.
+ */
+bool AudioFileReader::warmHotTargets(uint64_t preValid, uint64_t postValid) {
+	if (segmentCache == NULL) return false;
+	const uint64_t length = numSamples.load(std::memory_order_relaxed);
+	const uint64_t playhead = pos.load(std::memory_order_relaxed);
+
+	std::vector<uint64_t> targets;
+	hotLock.lock();
+	if (hotStart) targets.push_back(0);
+	for (int offset : hotOffsets) {
+		if (offset < 0 && (uint64_t) -(int64_t) offset >= playhead) {
+			targets.push_back(0);
+		} else if (offset > 0 && playhead + (uint64_t) offset >= length) {
+			continue;
+		} else {
+			targets.push_back(playhead + (int64_t) offset);
+		}
+	}
+	hotLock.unlock();
+
+	const unsigned chunkSize = segmentCache->getChunkSize();
+	for (uint64_t target : targets) {
+		if (target >= preValid && target + MAX_REQUEST <= postValid) continue;
+		if (pcmCache != NULL && getCached(target, MAX_REQUEST) != NULL) continue;
+
+		//the first read after a jump can span two chunks
+		for (unsigned chunk = (unsigned) (target / chunkSize); chunk <= (target + MAX_REQUEST - 1) / chunkSize && (uint64_t) chunk * chunkSize < length; chunk++) {
+			//the last chunk of a recording in progress isn't finished yet
+			if (tailing && (uint64_t) (chunk + 1) * chunkSize > length) break;
+			if (segmentCache->contains(chunk) || (archive != NULL && archive->contains(chunk))) continue;
+			decodeIntoCache(chunk, playhead);
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Decodes one chunk into the segment cache, unless a reset is requested first. While the length
+ * is only estimated, the whole chunk is decoded, since the file may not end where we think.
+ */
+void AudioFileReader::decodeIntoCache(unsigned chunk, uint64_t playhead) {
+	const uint64_t length = numSamples.load(std::memory_order_relaxed);
+	const unsigned chunkSize = segmentCache->getChunkSize();
+	const uint64_t start = (uint64_t) chunk * chunkSize;
+	const unsigned count = (start + chunkSize > length && !lengthPending) ? (unsigned) (length - start) : chunkSize;
+	for (unsigned at = 0; at < count; at += DECODE_BATCH) {
+		if (!alive || requestingReset.load(std::memory_order_relaxed) != NO_REQUEST) return;
+		readInto(&hotBuffer[at], start + at, DECODE_BATCH, decoder);
+	}
+	segmentCache->insert(chunk, hotBuffer, count, playhead);
+	if (archive != NULL) archive->insert(chunk, hotBuffer, count);
+}
+
+/*
+ * Earliest deadline first: for each cursor, find the first audio it wants that isn't decoded yet
+ * and when it will need it. Audio just past the end of the buffer is decoded into the buffer, and
+ * anything else goes into the segment cache. Sets chunk for FILL_CACHE.
+ */
+AudioFileReader::Task AudioFileReader::nextTask(uint64_t preValid, uint64_t postValid, bool bufferHasRoom, unsigned &chunk) const {
+	const uint64_t length = numSamples.load(std::memory_order_relaxed);
+	const uint64_t playhead = pos.load(std::memory_order_relaxed);
+	Task task = IDLE;
+	int64_t earliest = NO_DEADLINE;
+
+	//playback always reads from the buffer
+	if (bufferHasRoom) {
+		const ReadCursor &playback = cursors[PLAYBACK_CURSOR];
+		const double ahead = (postValid > playhead) ? (double) (postValid - playhead) : 0.0;
+		earliest = playback.deadline.load(std::memory_order_relaxed);
+		if (earliest != NO_DEADLINE) earliest += (int64_t) (1e9 * ahead / (double) playback.samplesPerSecond.load(std::memory_order_relaxed));
+		task = FILL_BUFFER;
+		if (earliest == NO_DEADLINE) earliest = NO_DEADLINE - 1;
+	}
+
+	for (int i = PLAYBACK_CURSOR + 1; i < MAX_CURSORS; i++) {
+		const ReadCursor &cursor = cursors[i];
+		if (!cursor.inUse.load(std::memory_order_acquire)) continue;
+		const int64_t deadline = cursor.deadline.load(std::memory_order_acquire);
+		if (deadline == NO_DEADLINE) continue;
+
+		const uint64_t from = cursor.position.load(std::memory_order_relaxed);
+		const unsigned lookahead = cursor.lookahead.load(std::memory_order_relaxed);
+
+		const int64_t stride = cursor.stride.load(std::memory_order_relaxed);
+		if (stride != 0) {
+			//a scrubbing cursor only wants the segment under each grain, in the order it gets to them
+			if (segmentCache == NULL) continue;
+			const uint64_t step = (uint64_t) ((stride < 0) ? -stride : stride);
+			uint64_t at = from;
+			uint64_t distance = 0;
+			bool wanted = false;
+			for (; distance < lookahead; distance += step) {
+				if (stride < 0 && distance > from) break;
+				at = (stride > 0) ? from + distance : from - distance;
+				if (at >= length || (tailing && at + segmentCache->getChunkSize() > length)) break;
+				if (!isDecoded(at)) {
+					wanted = true;
+					break;
+				}
+			}
+			if (!wanted) continue;
+
+			const int64_t needed = deadline + (int64_t) (1e9 * (double) distance / (double) cursor.samplesPerSecond.load(std::memory_order_relaxed));
+			if (needed >= earliest) continue;
+			task = FILL_CACHE;
+			chunk = (unsigned) (at / segmentCache->getChunkSize());
+			earliest = needed;
+			continue;
+		}
+
+		uint64_t to = (from + lookahead > length) ? length : from + lookahead;
+		if (tailing && segmentCache != NULL && to == length) to -= to % segmentCache->getChunkSize();
+
+		//skip past everything that is already decoded
+		uint64_t at = from;
+		while (at < to) {
+			if (at >= preValid && at < postValid) {
+				at = postValid;
+			} else if (pcmCache != NULL && getCached(at, 1) != NULL) {
+				at = fromSource(pcmCache->numCached());
+			} else if (segmentCache != NULL && (segmentCache->contains((unsigned) (at / segmentCache->getChunkSize())) || (archive != NULL && archive->contains((unsigned) (at / segmentCache->getChunkSize()))))) {
+				at += segmentCache->getChunkSize() - at % segmentCache->getChunkSize();
+			} else break;
+		}
+		if (at >= to) continue;
+
+		const int64_t needed = deadline + (int64_t) (1e9 * (double) (at - from) / (double) cursor.samplesPerSecond.load(std::memory_order_relaxed));
+		if (needed >= earliest) continue;
+
+		if (at >= postValid && at < playhead + MAX_POST) {
+			//the buffer will get to it
+			if (!bufferHasRoom) continue;
+			task = FILL_BUFFER;
+		} else if (segmentCache != NULL) {
+			task = FILL_CACHE;
+			chunk = (unsigned) (at / segmentCache->getChunkSize());
+		} else continue;
+		earliest = needed;
+	}
+
+	return task;
+}
+
+/*
+ * Copies every whole chunk in the valid part of the buffer into the segment cache and the compressed
+ * history, so it can be reused after the buffer has moved on. Only the preloader thread calls this,
+ * and nothing writes to the valid part of the buffer.
+ */
+void AudioFileReader::rememberDecoded(uint64_t preValid, uint64_t postValid) {
+	if (segmentCache == NULL) return;
+	const uint64_t length = numSamples.load(std::memory_order_relaxed);
+	const unsigned chunkSize = segmentCache->getChunkSize();
+	const uint64_t playhead = pos.load(std::memory_order_relaxed);
+
+	for (unsigned chunk = (unsigned) ((preValid + chunkSize - 1) / chunkSize); (uint64_t) chunk * chunkSize < postValid; chunk++) {
+		const uint64_t start = (uint64_t) chunk * chunkSize;
+		//the last chunk of the file is allowed to be short, once the file's length is known for sure
+		if (start + chunkSize > postValid && (postValid != length || !lengthFinal())) break;
+		const bool cached = segmentCache->contains(chunk);
+		const bool archived = (archive == NULL || archive->contains(chunk));
+		if (cached && archived) continue;
+
+		const unsigned count = (start + chunkSize > postValid) ? (unsigned) (postValid - start) : chunkSize;
+		const float *samples = ringSamples(start, count, hotBuffer);
+		if (!cached) segmentCache->insert(chunk, samples, count, playhead);
+		if (!archived) archive->insert(chunk, samples, count);
+	}
+}
+
+HOT void AudioFileReader::decoderLoop(DecodeJob *job) {
+	std::unique_lock<std::mutex> lock(jobLock);
+	while (alive) {
+		if (!job->pending) {
+			jobReady.wait(lock);
+			continue;
+		}
+		const uint64_t end = job->end;
+		uint64_t at = job->start;
+		const uint64_t length = numSamples.load(std::memory_order_acquire);
+		lock.unlock();
+
+		//each helper has its own SoX handle. Open it the first time it is needed.
+		if (job->decoder == NULL) {
+			try {
+				job->decoder = new Decoder(filename, NULL, seekIndex, sourceChannels, sourceSamples, channelMode, resampler, readAhead, DECODE_BATCH);
+			} catch (...) {
+				job->decoder = NULL;
+			}
+		}
+		const bool failed = (job->decoder == NULL);
+
+		while (job->decoder != NULL && alive && at < end && at < length && !abortJobs.load(std::memory_order_relaxed)) {
+			decodeIntoRing(at, DECODE_BATCH, job->decoder, job->stage);
+			at += DECODE_BATCH;
+			job->done.store(at, std::memory_order_release);
+			jobProgress.notify_one();
+		}
+
+		lock.lock();
+		job->pending = false;
+		job->failed |= failed;
+		jobProgress.notify_one();
+	}
+}
+
+HOT void AudioFileReader::readInto(float *dest, uint64_t at, unsigned count, Decoder *source) {
+	if (pcmCache != NULL) {
+		const float *cached = getCached(at, count);
+		if (cached != NULL) {
+			if (channelMode == ALL_CHANNELS) {
+				std::memcpy((void*) dest, (const void*) cached, count * sizeof(float));
+			} else {
+				mapChannels(dest, cached, count, sourceChannels, channelMode);
+			}
+			return;
+		}
+	}
+	if (segmentCache != NULL && segmentCache->copy(dest, at, count)) return;
+	if (archive != NULL && archive->copy(dest, at, count)) return;
+
+	if (!source->read(dest, at, count)) {
+		//Okay, something actually went wrong here
+		error = 1;
+		alive = false;
+	}
+}
+
+/*
+ * Copies decoded samples from wherever they are already kept, without waiting for the decoder or
+ * touching the ring. Returns false if any of them aren't there. Any thread may call this. stage
+ * must hold numFrames frames of every channel of the file.
+ */
+bool AudioFileReader::copyDecoded(float *dest, uint64_t frame, unsigned numFrames, float *stage) {
+	const uint64_t at = frame * fileInfo.numChannels;
+	const unsigned count = numFrames * fileInfo.numChannels;
+	const uint64_t length = numSamples.load(std::memory_order_acquire);
+	if (at + count > length) return false;
+
+	const float *samples = NULL;
+	if (pcmFile != NULL) {
+		samples = pcmFile->read(toSource(at), toSource(count), stage);
+	} else if (pcmCache != NULL) {
+		samples = getCached(at, count);
+	}
+	if (samples != NULL) {
+		if (channelMode == ALL_CHANNELS) {
+			std::memcpy((void*) dest, (const void*) samples, count * sizeof(float));
+		} else {
+			mapChannels(dest, samples, count, sourceChannels, channelMode);
+		}
+		return true;
+	}
+	if (segmentCache != NULL && segmentCache->copy(dest, at, count)) return true;
+	return archive != NULL && archive->copy(dest, at, count);
+}
+
+// True if the segment holding the sample at is in one of the caches. Needs a segment cache.
+bool AudioFileReader::isDecoded(uint64_t at) const {
+	if (pcmCache != NULL && getCached(at, 1) != NULL) return true;
+	const unsigned chunk = (unsigned) (at / segmentCache->getChunkSize());
+	return segmentCache->contains(chunk) || (archive != NULL && archive->contains(chunk));
+}
+
+// Copies decoded samples into the ring, converting them if it is compact
+HOT void AudioFileReader::storeRing(uint64_t at, const float *src, unsigned count) {
+	if (compactBuffer != NULL) {
+		floatToInt16(&compactBuffer[at & BUFFER_MASK], src, count);
+	} else {
+		std::memcpy((void*) &circleBuffer[at & BUFFER_MASK], (const void*) src, count * sizeof(float));
+	}
+}
+
+// Decodes straight into a float ring. A compact ring needs the samples staged in stage first.
+HOT void AudioFileReader::decodeIntoRing(uint64_t at, unsigned count, Decoder *source, float *stage) {
+	if (compactBuffer == NULL) {
+		readInto(&circleBuffer[at & BUFFER_MASK], at, count, source);
+		return;
+	}
+	readInto(stage, at, count, source);
+	floatToInt16(&compactBuffer[at & BUFFER_MASK], stage, count);
+}
+
+// Returns the samples in the ring as floats. A compact ring converts them into stage, which must hold count samples.
+HOT const float *AudioFileReader::ringSamples(uint64_t at, unsigned count, float *stage) const {
+	if (compactBuffer == NULL) return &circleBuffer[at & BUFFER_MASK];
+	int16ToFloat(stage, &compactBuffer[at & BUFFER_MASK], count);
+	return stage;
+}
+
+AudioFileReader::AudioStretcher::AudioStretcher(AudioFileReader *fileReader, StretchEngine engine, StretchQuality quality) : reader(fileReader), frameBytes(sizeof(float) * fileReader->fileInfo.numChannels),
+		requestFrames(fileReader->getMaxRequestBytes() / frameBytes), bufferFrames(fileReader->fileInfo.sampleRate * 3),
+		ringFrames((size_t) fileReader->fileInfo.sampleRate * STRETCH_RING_SECONDS + requestFrames),
+		behindFrames((size_t) fileReader->fileInfo.sampleRate * PRERENDER_BEHIND_SECONDS), aheadFrames((size_t) fileReader->fileInfo.sampleRate * PRERENDER_AHEAD_SECONDS) {
+	ring = new float[ringFrames * reader->fileInfo.numChannels];
+	block = new float[requestFrames * reader->fileInfo.numChannels];
+	stage = new float[requestFrames * reader->sourceChannels];
+	outPos = UINT64_MAX;
+	runStart = 0;
+	runPlayed = 0;
+	speed = 0.5f;
+	inPos = 0;
+	renderStart = 0;
+	runSpeed = speed;
+	evenSpeed = false;
+	wantRun = 0;
+	wantPosition = 0;
+	wantSpeed = speed;
+	playhead = 0;
+	haveRun = 0;
+	speedChangeAt = NO_SPEED_CHANGE;
+	nextSpeed = speed;
+	written = 0;
+	played = 0;
+	stretcher = TimeStretcher::create(engine, quality, reader->fileInfo.sampleRate, reader->fileInfo.numChannels);
+	stretcher->setSpeed(speed);
+	cursor = reader->openCursor("stretcher look-ahead");
+	active = false;
+	reading = false;
+	alive = true;
+	thread = new std::thread(&AudioStretcher::stretchLoop, this);
+}
+
+AudioFileReader::AudioStretcher::~AudioStretcher() {
+	alive = false;
+	active = false;
+	workLock.lock();
+	workLock.unlock();
+	wake.notify_all();
+	thread->join();
+	delete thread;
+	reader->closeCursor(cursor);
+	delete stretcher;
+	delete[] ring;
+	delete[] block;
+	delete[] stage;
+}
+
+HOT unsigned AudioFileReader::AudioStretcher::copyData(void *dest, uint64_t position, size_t numBytes) {
+	assert(numBytes % frameBytes == 0);
+	const size_t numFrames = numBytes / frameBytes;
+
+	if (position != outPos) {
+		//we've skipped to a new position, so the worker has to start over from there
+		wantPosition.store(position, std::memory_order_relaxed);
+		wantRun.store(wantRun.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		wake.notify_one();
+		outPos = position;
+		runStart = position;
+		runPlayed = 0;
+	}
+
+	//if there isn't enough stretched audio ready, play silence and try again next time
+	const uint64_t from = played.load(std::memory_order_relaxed);
+	if (haveRun.load(std::memory_order_acquire) != wantRun.load(std::memory_order_relaxed) || written.load(std::memory_order_acquire) - from < numFrames) {
+		std::memset(dest, 0, numBytes);
+		return 0;
+	}
+
+	const size_t at = (size_t) (from % ringFrames);
+	const size_t first = (numFrames < ringFrames - at) ? numFrames : ringFrames - at;
+	std::memcpy(dest, (const void*) &ring[at * reader->fileInfo.numChannels], first * frameBytes);
+	if (first < numFrames) std::memcpy((void*) ((char*) dest + first * frameBytes), (const void*) ring, (numFrames - first) * frameBytes);
+	played.store(from + numFrames, std::memory_order_release);
+	wake.notify_one();
+
+	//work out the position from where the speed last changed, so rounding doesn't add up over time
+	const uint64_t changeAt = speedChangeAt.load(std::memory_order_acquire);
+	if (changeAt <= from + numFrames) {
+		runStart += (uint64_t) ((double) (runPlayed + (changeAt - from)) * (double) speed);
+		runPlayed = from + numFrames - changeAt;
+		speed = nextSpeed.load(std::memory_order_relaxed);
+		speedChangeAt.store(NO_SPEED_CHANGE, std::memory_order_release);
+	} else {
+		runPlayed += numFrames;
+	}
+	const uint64_t reached = runStart + (uint64_t) ((double) runPlayed * (double) speed);
+	const unsigned covered = (unsigned) (reached - outPos);
+	outPos = reached;
+	return covered;
+}
+
+void AudioFileReader::AudioStretcher::setSpeed(float slow) {
+	wantSpeed.store(slow, std::memory_order_relaxed);
+	wake.notify_one();
+}
+
+void AudioFileReader::AudioStretcher::setActive(bool on) {
+	if (on) {
+		//the callback starts a new run from wherever it asks for next, which picks up any slowed audio there
+		outPos = UINT64_MAX;
+		active = true;
+		wake.notify_one();
+	} else {
+		active = false;
+	}
+}
+
+/*
+ * The worker sets reading before it checks active, and the callback clears active before it
+ * checks reading, so at least one of them sees the other.
+ */
+bool AudioFileReader::AudioStretcher::isReleased() const {
+	return !active.load() && !reading.load();
+}
+
+/*
+ * Points the callback at the slowed audio already in the ring for position, if the run has any.
+ * Only the worker calls this, while starting a run.
+ */
+bool AudioFileReader::AudioStretcher::reuse(uint64_t position) {
+	if (!evenSpeed || runSpeed != wantSpeed.load(std::memory_order_relaxed) || position < renderStart) return false;
+	const uint64_t index = outputIndex(position);
+	const uint64_t end = written.load(std::memory_order_relaxed);
+	if (index >= end || (end > ringFrames && index < end - ringFrames)) return false;
+
+	//the callback picks up the run's speed as a change right where it starts playing
+	played.store(index, std::memory_order_relaxed);
+	nextSpeed.store(runSpeed, std::memory_order_relaxed);
+	speedChangeAt.store(index, std::memory_order_relaxed);
+	return true;
+}
+
+// Empties the ring and the engine, and starts stretching from position. Only the worker calls this.
+void AudioFileReader::AudioStretcher::startFrom(uint64_t position, float newSpeed) {
+	stretcher->clear();
+	runSpeed = newSpeed;
+	stretcher->setSpeed(runSpeed);
+	inPos = position;
+	renderStart = position;
+	evenSpeed = true;
+	written.store(0, std::memory_order_relaxed);
+	played.store(0, std::memory_order_relaxed);
+
+	//the callback picks up the run's speed as a change at the very start of it
+	nextSpeed.store(runSpeed, std::memory_order_relaxed);
+	speedChangeAt.store(0, std::memory_order_relaxed);
+}
+
+// Starts over from where the callback asked
+void AudioFileReader::AudioStretcher::startRun(unsigned run) {
+	const uint64_t position = wantPosition.load(std::memory_order_relaxed);
+	if (!reuse(position)) {
+		startFrom(position, wantSpeed.load(std::memory_order_relaxed));
+		reader->jumpTo(inPos);
+	}
+	haveRun.store(run, std::memory_order_release);
+}
+
+// Asks for the grains of the run from index on, the first by the time the callback gets to it. Only the worker calls this.
+void AudioFileReader::AudioScrubber::askFor(uint64_t index, uint64_t done, uint64_t length) {
+	const unsigned pace = (unsigned) ((anchorSpeed < 0) ? -anchorSpeed : anchorSpeed);
+	const double secondsAhead = (double) (index - done) * (double) grainFrames / (double) reader->fileInfo.sampleRate;
+	reader->moveScrubCursor(cursor, grainFrame(index, length), (int64_t) anchorSpeed * grainFrames, pace * reader->fileInfo.sampleRate * SCRUB_AHEAD_SECONDS,
+		std::chrono::steady_clock::now() + std::chrono::nanoseconds((int64_t) (1e9 * secondsAhead)), (float) (pace * reader->fileInfo.sampleRate));
+}
+
+// Does one step of work for the worker. Returns false if there was nothing it could do.
+HOT bool AudioFileReader::AudioStretcher::stretchSome(bool slowing) {
+	const float target = wantSpeed.load(std::memory_order_relaxed);
+	uint64_t at = 0;
+	if (slowing) {
+		const unsigned run = wantRun.load(std::memory_order_acquire);
+		if (run != haveRun.load(std::memory_order_relaxed)) {
+			startRun(run);
+			return true;
+		}
+	} else {
+		//follow normal playback, starting over when it leaves the run behind
+		if (target >= 1.0f) return false;
+		at = playhead.load(std::memory_order_relaxed);
+		const uint64_t from = (at > behindFrames) ? at - behindFrames : 0;
+		if (target != runSpeed || !evenSpeed || at < renderStart || from > inPos) {
+			startFrom(from, target);
+			return true;
+		}
+		const uint64_t index = outputIndex(at);
+		const uint64_t end = written.load(std::memory_order_relaxed);
+		played.store((index < end) ? index : end, std::memory_order_relaxed);
+	}
+
+	const uint64_t end = written.load(std::memory_order_relaxed);
+	const size_t filled = (size_t) (end - played.load(std::memory_order_acquire));
+	const size_t room = ringFrames - keepFrames();
+	if (filled >= room) return false;
+
+	//move whatever the engine has ready into the ring, up to where it wraps around
+	const size_t ready = stretcher->available();
+	if (ready > 0) {
+		const size_t to = (size_t) (end % ringFrames);
+		size_t count = room - filled;
+		if (count > ringFrames - to) count = ringFrames - to;
+		if (count > ready) count = ready;
+		count = stretcher->read(&ring[to * reader->fileInfo.numChannels], (unsigned) count);
+		written.store(end + count, std::memory_order_release);
+		return true;
+	}
+
+	if (!slowing) {
+		//take the input from the caches, and ask the preloader for it if it isn't there
+		if (inPos >= at + aheadFrames) return false;
+		if (!reader->copyDecoded(block, inPos, (unsigned) requestFrames, stage)) {
+			const double secondsAhead = (inPos > at) ? (double) (inPos - at) / (double) reader->fileInfo.sampleRate : 0.0;
+			reader->moveCursor(cursor, inPos, (unsigned) bufferFrames, std::chrono::steady_clock::now() + std::chrono::nanoseconds((int64_t) (1e9 * secondsAhead)),
+				(float) reader->fileInfo.sampleRate);
+			return false;
+		}
+		stretcher->write(block, (unsigned) requestFrames);
+		inPos += requestFrames;
+		return true;
+	}
+
+	/*
+	 * Switch speeds before the next block of input, once the callback has caught up with the last
+	 * change. Everything the engine has already stretched, or is about to hand over, plays at the old speed.
+	 */
+	if (target != runSpeed && speedChangeAt.load(std::memory_order_acquire) == NO_SPEED_CHANGE) {
+		runSpeed = target;
+		evenSpeed = false;
+		stretcher->setSpeed(runSpeed);
+		nextSpeed.store(runSpeed, std::memory_order_relaxed);
+		speedChangeAt.store(end, std::memory_order_release);
+	}
+
+	//don't get so far ahead that going back to normal speed has to wait for the reader to catch up
+	if ((double) filled * (double) runSpeed >= (double) aheadFrames) return false;
+
+	//let the preloader know how long it has until we run out of input
+	const double secondsBuffered = (double) filled / (double) reader->fileInfo.sampleRate;
+	reader->moveCursor(cursor, inPos, (unsigned) bufferFrames, std::chrono::steady_clock::now() + std::chrono::nanoseconds((int64_t) (1e9 * secondsBuffered)),
+		runSpeed * (float) reader->fileInfo.sampleRate);
+
+	const void *input = reader->readData(inPos, requestFrames * frameBytes);
+	if (input == NULL) return false;
+	stretcher->write((const float*) input, (unsigned) requestFrames);
+	reader->releaseData();
+	inPos += requestFrames;
+	return true;
+}
+
+void AudioFileReader::AudioStretcher::stretchLoop() {
+	std::unique_lock<std::mutex> lock(workLock);
+	while (alive) {
+		//only read the file while slowing, and say so before looking, so stopping can't miss it
+		reading.store(true);
+		const bool slowing = active.load();
+		if (!slowing) reading.store(false, std::memory_order_release);
+		const bool worked = stretchSome(slowing);
+		reading.store(false, std::memory_order_release);
+		if (!worked) {
+			//wait for the callback to make room, or for the preloader to decode more
+			wake.wait_for(lock, std::chrono::milliseconds(active ? STRETCH_POLL_MILLISECONDS : PRERENDER_POLL_MILLISECONDS));
+		}
+	}
+}
+
+// Where a playhead moving at speed gets to after numFrames frames, stopping at either end of the file
+INLINE static uint64_t scrubbedTo(uint64_t position, int speed, uint64_t numFrames, uint64_t length) {
+	const uint64_t moved = numFrames * (uint64_t) ((speed < 0) ? -speed : speed);
+	if (speed < 0) return (moved < position) ? position - moved : 0;
+	return (position + moved < length) ? position + moved : length;
+}
+
+AudioFileReader::AudioScrubber::AudioScrubber(AudioFileReader *fileReader) : reader(fileReader), frameBytes(sizeof(float) * fileReader->fileInfo.numChannels),
+		grainFrames(fileReader->fileInfo.sampleRate * SCRUB_GRAIN_MILLISECONDS / 1000), fadeFrames(fileReader->fileInfo.sampleRate * SCRUB_FADE_MILLISECONDS / 1000),
+		grid((fileReader->segmentCache != NULL) ? fileReader->segmentCache->getChunkSize() / fileReader->fileInfo.numChannels : 1) {
+	slots = new float[(size_t) SCRUB_GRAINS * grainFrames * reader->fileInfo.numChannels];
+	stage = new float[grainFrames * reader->sourceChannels];
+	for (int i = 0; i < SCRUB_GRAINS; i++) slotStart[i] = 0;
+	runFrom = 0;
+	runSpeed = 0;
+	grainIndex = 0;
+	grainPlayed = grainFrames;
+	haveGrain = false;
+	anchor = 0;
+	anchorSpeed = 0;
+	wantRun = 0;
+	wantPosition = 0;
+	wantSpeed = 0;
+	haveRun = 0;
+	written = 0;
+	played = 0;
+	cursor = reader->openCursor("scrubbing");
+	scrubbing = false;
+	alive = true;
+	thread = new std::thread(&AudioScrubber::scrubLoop, this);
+}
+
+AudioFileReader::AudioScrubber::~AudioScrubber() {
+	alive = false;
+	scrubbing = false;
+	workLock.lock();
+	workLock.unlock();
+	wake.notify_all();
+	thread->join();
+	delete thread;
+	reader->closeCursor(cursor);
+	delete[] slots;
+	delete[] stage;
+}
+
+// Where the worker takes grain index of its run from, kept inside the segment under it, which is what the cursor asks for
+uint64_t AudioFileReader::AudioScrubber::grainFrame(uint64_t index, uint64_t length) const {
+	uint64_t frame = scrubbedTo(anchor, anchorSpeed, index * grainFrames, length);
+	if (grid > grainFrames) {
+		const uint64_t segmentEnd = (frame / grid + 1) * grid;
+		if (frame + grainFrames > segmentEnd) frame = segmentEnd - grainFrames;
+	}
+	return frame;
+}
+
+// Moves on to the grain for the playhead at frame, starting a new run if the playhead has left the old one. Only the callback calls this.
+void AudioFileReader::AudioScrubber::nextGrain(uint64_t frame, int speed, uint64_t length) {
+	if (haveGrain) {
+		//the worker can reuse the slot of the grain that just finished
+		grainIndex++;
+		played.store(grainIndex, std::memory_order_release);
+		wake.notify_one();
+	}
+	grainPlayed = 0;
+
+	const uint64_t expected = scrubbedTo(runFrom, runSpeed, grainIndex * grainFrames, length);
+	const uint64_t drift = (frame > expected) ? frame - expected : expected - frame;
+	if (speed != runSpeed || drift >= (uint64_t) grainFrames * (uint64_t) ((speed < 0) ? -speed : speed)) {
+		runFrom = frame;
+		runSpeed = speed;
+		grainIndex = 0;
+		played.store(0, std::memory_order_relaxed);
+		wantPosition.store(frame, std::memory_order_relaxed);
+		wantSpeed.store(speed, std::memory_order_relaxed);
+		wantRun.store(wantRun.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		wake.notify_one();
+	}
+	haveGrain = (haveRun.load(std::memory_order_acquire) == wantRun.load(std::memory_order_relaxed) && written.load(std::memory_order_acquire) > grainIndex);
+}
+
+HOT void AudioFileReader::AudioScrubber::copyData(void *dest, uint64_t position, int speed, size_t numBytes, bool audible) {
+	assert(numBytes % frameBytes == 0);
+	const size_t numFrames = numBytes / frameBytes;
+	const unsigned channels = reader->fileInfo.numChannels;
+	const uint64_t length = reader->getNumFrames();
+	float *out = (float*) dest;
+
+	if (!scrubbing.load(std::memory_order_relaxed)) {
+		scrubbing.store(true, std::memory_order_relaxed);
+		wake.notify_one();
+	}
+
+	for (size_t done = 0; done < numFrames;) {
+		if (grainPlayed >= grainFrames) nextGrain(scrubbedTo(position, speed, done, length), speed, length);
+
+		//a grain that isn't ready yet is looked for again next time
+		size_t count = haveGrain ? grainFrames - grainPlayed : numFrames - done;
+		if (count > numFrames - done) count = numFrames - done;
+		if (haveGrain && audible) {
+			std::memcpy((void*) &out[done * channels], (const void*) &slot(grainIndex)[grainPlayed * channels], count * frameBytes);
+		} else {
+			std::memset((void*) &out[done * channels], 0, count * frameBytes);
+		}
+		grainPlayed = haveGrain ? grainPlayed + (unsigned) count : grainFrames;
+		done += count;
+	}
+}
+
+uint64_t AudioFileReader::AudioScrubber::finish(uint64_t position) {
+	/*
+	 * The worker may still finish a step, but it never touches a slot the callback hasn't played,
+	 * and the next scrub starts a new run anyway, so there is no need to wait for it.
+	 */
+	scrubbing.store(false, std::memory_order_relaxed);
+
+	const uint64_t landing = haveGrain ? slotStart[grainIndex % SCRUB_GRAINS] + grainPlayed : position;
+	grainPlayed = grainFrames;
+	haveGrain = false;
+	runSpeed = 0; // the next scrub starts a new run
+	return landing;
+}
+
+// Does one step of work for the worker. Returns false if there was nothing it could do.
+HOT bool AudioFileReader::AudioScrubber::scrubSome() {
+	const unsigned run = wantRun.load(std::memory_order_acquire);
+	if (run != haveRun.load(std::memory_order_relaxed)) {
+		anchor = wantPosition.load(std::memory_order_relaxed);
+		anchorSpeed = wantSpeed.load(std::memory_order_relaxed);
+		written.store(0, std::memory_order_relaxed);
+		haveRun.store(run, std::memory_order_release);
+		return true;
+	}
+
+	//the slot for the next grain is free once the callback is done with the grain before it
+	const uint64_t next = written.load(std::memory_order_relaxed);
+	const uint64_t done = played.load(std::memory_order_acquire);
+	if (next >= done + SCRUB_GRAINS) return false;
+
+	const uint64_t length = reader->getNumFrames();
+	const uint64_t frame = grainFrame(next, length);
+	float *grain = slot(next);
+	if (!reader->copyDecoded(grain, frame, grainFrames, stage)) {
+		askFor(next, done, length);
+		return false;
+	}
+
+	//fade the ends so the jumps between grains don't click
+	const unsigned channels = reader->fileInfo.numChannels;
+	for (unsigned i = 0; i < fadeFrames; i++) {
+		const float gain = 0.5f - 0.5f * std::cos((float) M_PI * (float) (i + 1) / (float) (fadeFrames + 1));
+		for (unsigned c = 0; c < channels; c++) {
+			grain[i * channels + c] *= gain;
+			grain[(grainFrames - 1 - i) * channels + c] *= gain;
+		}
+	}
+	slotStart[next % SCRUB_GRAINS] = frame;
+	written.store(next + 1, std::memory_order_release);
+	askFor(next + 1, done, length);
+	return true;
+}
+
+void AudioFileReader::AudioScrubber::scrubLoop() {
+	std::unique_lock<std::mutex> lock(workLock);
+	bool parked = true;
+	while (alive) {
+		if (!scrubbing.load(std::memory_order_relaxed)) {
+			//a cursor with nothing ahead of it asks for nothing
+			if (!parked) reader->moveCursor(cursor, 0, 0, std::chrono::steady_clock::now(), 1.0f);
+			parked = true;
+			wake.wait_for(lock, std::chrono::milliseconds(PRERENDER_POLL_MILLISECONDS));
+			continue;
+		}
+		parked = false;
+		if (!scrubSome()) {
+			//wait for the callback to finish a grain, or for the preloader to decode more
+			wake.wait_for(lock, std::chrono::milliseconds(STRETCH_POLL_MILLISECONDS));
+		}
 	}
 }
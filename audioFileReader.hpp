@@ -3,138 +3,581 @@
 
 #include <cstring>
 #include <cassert>
+#include <cstdint>
 #include <thread>
 #include <mutex>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <vector>
 
-#include <sonic.h>
 #include <sox.h>
 
 #include "attributes.hpp"
+#include "mirroredBuffer.hpp"
+#include "pcmCache.hpp"
+#include "pcmFileMap.hpp"
+#include "seekIndex.hpp"
+#include "decoder.hpp"
+#include "segmentCache.hpp"
+#include "historyArchive.hpp"
+#include "resampler.hpp"
+#include "timeStretcher.hpp"
 
+/*
+ * Positions outside the reader are in frames (one sample of every channel), so the transport
+ * never has to divide by the number of channels. Inside, the ring and caches count samples.
+ */
 struct PACKED AudioFileInfo {
 	unsigned sampleRate;
 	unsigned numChannels;
-	size_t numSamples;
+};
+
+// Used to keep counters written by different threads from sharing a cache line
+#define CACHE_LINE_SIZE 64
+
+// How much the preloader decodes at once. This is independent of the latency setting, which only sets how much the audio callback asks for.
+#define DECODE_BATCH_MILLISECONDS 250
+
+// Most helper threads used to decode segments of the file in parallel
+#define MAX_DECODER_THREADS 3
+
+// Memory set aside for recently decoded audio, so jumping back to it doesn't have to decode it again
+#define SEGMENT_CACHE_MEGABYTES 64
+
+// How much of the compressed file is kept read ahead of each decoder
+#define READ_AHEAD_MEGABYTES 4
+
+// A file modified this recently when it is opened may still be recording. A recording that hasn't grown for this long is finished.
+#define RECORDING_IDLE_SECONDS 10
+
+// How long a recently modified file is watched when it is opened. It only counts as a recording if it is written to in this time.
+#define RECORDING_PROBE_MILLISECONDS 1000
+
+// How far a recording can grow without SoX reading any of it before the decoder is restarted
+#define TAIL_STALL_BYTES (256 << 10)
+
+// Most cursors that can be registered at once, including the playback cursor
+#define MAX_CURSORS 8
+
+// Room for slowed audio, in seconds of output. This is also how far slowed playback can get ahead.
+#define STRETCH_RING_SECONDS 30
+
+// While the audio isn't slowed, how much of it is slowed ahead of time around the playhead, so slowing down starts straight away
+#define PRERENDER_BEHIND_SECONDS 3
+#define PRERENDER_AHEAD_SECONDS 10
+
+// Scrubbing plays grains this long from wherever the playhead is, with fades this long at either end
+#define SCRUB_GRAIN_MILLISECONDS 120
+#define SCRUB_FADE_MILLISECONDS 5
+
+// How far ahead of the playhead, in time rather than audio, scrubbing asks for grains
+#define SCRUB_AHEAD_SECONDS 2
+
+// Grains the scrubber's worker keeps ready for the callback, including the one playing
+#define SCRUB_GRAINS 4
+
+/*
+ * Something reading through the file, such as playback, the time stretcher's look-ahead, or a
+ * background analysis job. The preloader decodes whatever the cursor with the earliest deadline
+ * needs next, so real-time playback always wins and background cursors get the idle time.
+ */
+struct ReadCursor {
+	const char *name;
+	std::atomic<bool> inUse;
+	std::atomic<uint64_t> position;
+	std::atomic<unsigned> lookahead; // how far past position the cursor wants decoded
+	std::atomic<int64_t> deadline; // steady clock time (in nanoseconds) by which the audio at position is needed
+	std::atomic<float> samplesPerSecond; // how fast the cursor moves through the file
+	std::atomic<int64_t> stride; // for a scrubbing cursor, how far apart the grains it wants are, negative going backwards. 0 wants everything.
+};
+
+// A segment of the file being decoded into the ring by a helper thread
+struct DecodeJob {
+	Decoder *decoder;
+	std::thread *thread;
+	uint64_t start;
+	uint64_t end;
+	std::atomic<uint64_t> done; // everything in [start, done) has been decoded
+	float *stage; // holds each batch before it is converted into a compact ring
+	bool pending;
+	bool failed; // the helper couldn't open its own decoder, so the segment was left undecoded
+	char padding[CACHE_LINE_SIZE];
 };
 
 class AudioFileReader {
   private:
 	std::atomic<bool> alive;
-	int error;
+	std::atomic<int> error; // set by whichever decoding thread fails
 
-	sox_format_t *audioFile;
-	AudioFileInfo fileInfo;
+	AudioFileInfo fileInfo; // what is played, after the channels are mapped and the audio is resampled
+
+	/*
+	 * The length of what is played. Once the file is open, only the preloader changes it, so the
+	 * preloader reads it relaxed, and every other thread loads it once with acquire and uses that.
+	 */
+	std::atomic<uint64_t> numSamples; // numFrames * fileInfo.numChannels
+	std::atomic<uint64_t> numFrames;
 	char *filename;
 
+	// The file itself. Unless every channel is played, fileInfo is mono and positions in the file are scaled by sourceChannels.
+	unsigned sourceChannels;
+	size_t sourceSamples;
+	ChannelMode channelMode;
+
 	unsigned MAX_REQUEST;
+	unsigned DECODE_BATCH;
 	unsigned MAX_PRE;
 	unsigned MAX_POST;
 	unsigned BUFFER_SIZE;
+	unsigned BUFFER_MASK;
+
+	PcmFileMap *pcmFile;
+	PcmCache *pcmCache;
+	SeekIndex *seekIndex;
+	Resampler *resampler;
+	ReadAhead *readAhead;
+	int mapStream; // the read-ahead stream that keeps the mapped file ahead of playback in memory
+	Decoder *decoder;
+	SegmentCache *segmentCache;
+	HistoryArchive *archive;
+	MirroredBuffer *ringMemory;
 
+	/*
+	 * The ring holds either floats (circleBuffer) or, to halve its size, 16-bit samples
+	 * (compactBuffer). Only one of them is set. Compact samples are decoded into a float stage
+	 * first, and converted back into converted when readData hands them out.
+	 */
 	float *circleBuffer;
-	int *toConvert;
+	int16_t *compactBuffer;
+	float *converted; // only touched by readData. Also holds mapped channels read straight from a mapping.
+	float *scratch;
 	float *nil;
 
-	unsigned preValid;
-	unsigned postValid;
-	unsigned pos;
+	/*
+	 * The buffer is a single producer (preloaderLoop), single consumer (readData) ring.
+	 * Neither side ever takes a lock. The valid range [preValid, postValid] is guarded by a
+	 * sequence number that is odd while the preloader changes it, so the consumer always reads
+	 * a consistent pair. The counters written by each side are kept on separate cache lines.
+	 */
+	std::atomic<unsigned> windowSequence; // written by the preloader thread
+	std::atomic<uint64_t> windowStart; // written by the preloader thread
+	std::atomic<uint64_t> windowEnd; // written by the preloader thread
+	std::atomic<bool> claimWaiting; // written by the preloader thread while it waits for readData to let go of a claim
+	char producerPadding[CACHE_LINE_SIZE];
+	std::atomic<uint64_t> pos; // written by readData
+	std::atomic<uint64_t> claim; // written by readData
+	std::atomic<uint64_t> requestingReset; // written by readData
+	char consumerPadding[CACHE_LINE_SIZE];
 
 	std::thread *readerThread;
-	std::mutex accessLock;
+	std::mutex waitLock;
 	std::condition_variable bufferMoved;
-	std::condition_variable readRequest;
-	std::condition_variable resetRequest;
-	unsigned requestingReset;
+	std::condition_variable claimReleased;
+	std::chrono::milliseconds pollInterval;
+
+	/*
+	 * Once the seek index is ready, frames can be decoded independently, so a large refill
+	 * is split into segments which are decoded concurrently by helper threads.
+	 */
+	DecodeJob *jobs;
+	unsigned numJobs;
+	unsigned SEGMENT_SIZE;
+	bool parallelDecoding; // only touched by the preloader. Cleared for good once a helper fails.
+	std::atomic<bool> abortJobs;
+	std::mutex jobLock;
+	std::condition_variable jobReady;
+	std::condition_variable jobProgress;
+
+	/*
+	 * Jumps the user can make with a single button or pedal press, relative to the playhead.
+	 * The preloader keeps the audio at each of them in the segment cache while it is idle.
+	 */
+	std::vector<int> hotOffsets;
+	bool hotStart;
+	std::mutex hotLock;
+	float *hotBuffer;
+
+	/*
+	 * Cursor 0 is playback, and is moved by readData. The ring buffer follows it, while the
+	 * other cursors are served through the segment cache.
+	 */
+	ReadCursor cursors[MAX_CURSORS];
+
+	enum PACKED Task {
+		IDLE,
+		FILL_BUFFER,
+		FILL_CACHE
+	};
+
+	/*
+	 * Tail mode, for recordings that are still being written. The file is watched with inotify
+	 * (or by its size, if that fails), and while the buffer is at the end of the file, the
+	 * preloader decodes whatever has been added and grows the length to include it. Tail mode
+	 * ends once the recorder closes the file, or the file stops growing, and the decoder has
+	 * caught up with it. Only the preloader touches these once the file is open.
+	 */
+	bool tailing;
+	int watchFd;
+	size_t watchedSize;
+	size_t tailBytes; // the file's size when something new was last read from it
+	bool tailPending; // the file has changed since the decoder last caught up with it
+	bool writerClosed; // the recorder has closed the file
+	std::chrono::steady_clock::time_point lastGrowth;
+	std::atomic<bool> recordingEnded; // set when tail mode ends
+
+	/*
+	 * Set if the file's header didn't give its length, so the length is only an estimate
+	 * until the seek index is ready. Only changed by the preloader once the file is open.
+	 */
+	bool lengthPending;
+
+	// Only touched by the thread calling jumpTo and readData
+	uint64_t pendingJump;
+	std::atomic<unsigned> jumpHits;
+	std::atomic<unsigned> jumpMisses;
+
+	// False while the length of the file may still change
+	INLINE bool lengthFinal() const { return !tailing && !lengthPending; }
+
+	INLINE size_t toSource(size_t position) const { return (channelMode == ALL_CHANNELS) ? position : position * sourceChannels; }
+	INLINE size_t fromSource(size_t position) const { return (channelMode == ALL_CHANNELS) ? position : position / sourceChannels; }
+
+	USERET bool copyDecoded(float *dest, uint64_t frame, unsigned numFrames, float *stage);
+	USERET bool isDecoded(uint64_t at) const;
+
+	// Returns the samples in [at, at + count) from the on-disk cache, with every channel of the file, or NULL if they aren't all cached
+	INLINE const float *getCached(uint64_t at, unsigned count) const { return pcmCache->get(toSource(at), toSource(count)); }
+
+	// Changes what readData has claimed, and wakes the preloader if it's waiting for the old claim to go
+	INLINE void setClaim(uint64_t at) {
+		claim.store(at);
+		if (claimWaiting.load()) claimReleased.notify_one();
+	}
+
+	// Only the preloader thread may store the window
+	INLINE void storeWindow(uint64_t preValid, uint64_t postValid) {
+		const unsigned sequence = windowSequence.load(std::memory_order_relaxed);
+		windowSequence.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		windowStart.store(preValid, std::memory_order_relaxed);
+		windowEnd.store(postValid, std::memory_order_relaxed);
+		windowSequence.store(sequence + 2);
+	}
+	INLINE void loadWindow(uint64_t &preValid, uint64_t &postValid) const {
+		unsigned sequence;
+		do {
+			sequence = windowSequence.load();
+			preValid = windowStart.load(std::memory_order_relaxed);
+			postValid = windowEnd.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+		} while ((sequence & 1) != 0 || windowSequence.load(std::memory_order_relaxed) != sequence);
+	}
+
+	// Sets the length of the file, from the preloader thread. numFrames is stored last, since readData only looks at numSamples.
+	INLINE void setLength(uint64_t samples) {
+		numSamples.store(samples, std::memory_order_release);
+		numFrames.store(samples / fileInfo.numChannels, std::memory_order_release);
+	}
 
 	HOT void preloaderLoop();
-	HOT void readInto(unsigned index, unsigned &head);
+	HOT void decoderLoop(DecodeJob *job);
+	HOT void readInto(float *dest, uint64_t at, unsigned count, Decoder *source);
+	HOT void storeRing(uint64_t at, const float *src, unsigned count);
+	HOT void decodeIntoRing(uint64_t at, unsigned count, Decoder *source, float *stage);
+	USERET HOT const float *ringSamples(uint64_t at, unsigned count, float *stage) const;
+	void publishWindow(uint64_t preValid, uint64_t postValid, uint64_t writeFrom, unsigned writeCount);
+	USERET uint64_t decodedPrefix(uint64_t from, unsigned numSegments, uint64_t lastDone) const;
+	void decodeSegments(uint64_t preValid, uint64_t from, unsigned numSegments);
+	void rememberDecoded(uint64_t preValid, uint64_t postValid);
+	USERET bool backfill(uint64_t preValid, uint64_t postValid);
+	void settleLength();
+	USERET bool fileChanged();
+	USERET bool followTail(uint64_t preValid, uint64_t postValid);
+	void endTail();
+	USERET bool warmHotTargets(uint64_t preValid, uint64_t postValid);
+	void decodeIntoCache(unsigned chunk, uint64_t playhead);
+	USERET Task nextTask(uint64_t preValid, uint64_t postValid, bool bufferHasRoom, unsigned &chunk) const;
 
   public:
-	AudioFileReader(const char *fname, unsigned maxRequestMilliseconds, unsigned maxRememberSeconds, unsigned maxPreloadSeconds);
+	/*
+	 * If recording is true, the file is followed as it grows. It should be what isBeingRecorded
+	 * returned, which is left to the caller since it watches the file for up to
+	 * RECORDING_PROBE_MILLISECONDS, and shouldn't be done with any locks held.
+	 */
+	AudioFileReader(const char *fname, unsigned maxRequestMilliseconds, unsigned maxRememberSeconds, unsigned maxPreloadSeconds, unsigned maxCacheMegabytes, bool compactHistory, unsigned maxArchiveMegabytes, ChannelMode channelMode, bool recording, unsigned outputRate, StretchEngine stretchEngine, StretchQuality stretchQuality);
 	~AudioFileReader();
 
 	USERET INLINE const AudioFileInfo &getFileInfo() const { return fileInfo; }
 
+	// True if the file seems to be a recording that is still being made. Blocks for up to RECORDING_PROBE_MILLISECONDS.
+	USERET static bool isBeingRecorded(const char *fname);
+
+	// The length of the file in frames. Recordings still being made grow, and estimated lengths are corrected once known.
+	USERET INLINE uint64_t getNumFrames() const { return numFrames.load(std::memory_order_acquire); }
+
 	USERET bool loadFile(char *fname, unsigned maxRequestMilliseconds, unsigned maxRememberSeconds, unsigned maxPreloadSeconds);
 	size_t setBufferSettings(unsigned maxRequestMilliseconds, unsigned maxRememberSeconds, unsigned maxPreloadSeconds);
 
 	USERET size_t getMaxRequestBytes() const { return(sizeof(float) * MAX_REQUEST); }
 
-	USERET const void *readData(unsigned position, size_t numBytes);
-	INLINE void copyData(void *dest, unsigned position, size_t numBytes) { std::memcpy(dest, readData(position, numBytes), numBytes); }
+	/*
+	 * Returns a pointer to the samples starting at the given frame, which remains valid until the next
+	 * call to readData, releaseData, or jumpTo. Until then, the preloader won't overwrite them.
+	 * This never blocks. If the data has not been decoded yet, NULL is returned and the preloader is
+	 * asked to fetch it. Only one thread (the audio callback) may call readData.
+	 */
+	USERET HOT const void *readData(uint64_t frame, size_t numBytes);
+	INLINE bool copyData(void *dest, uint64_t frame, size_t numBytes) {
+		const void *data = readData(frame, numBytes);
+		if (data == NULL) {
+			std::memset(dest, 0, numBytes);
+			return false;
+		}
+		std::memcpy(dest, data, numBytes);
+		releaseData();
+		return true;
+	}
+
+	// Says the data readData last returned isn't needed any more. Only the thread calling readData may call this.
+	void releaseData();
+
+	/*
+	 * Sets the jumps to keep decoded, as offsets from the playhead in frames. If includeStart is
+	 * true, the start of the file is kept decoded as well.
+	 */
+	void setHotOffsets(const std::vector<int> &offsets, bool includeStart);
+
+	/*
+	 * Called when the user jumps to a new position, so the preloader can start on it before the
+	 * audio callback asks for it. Must not be called at the same time as readData.
+	 */
+	void jumpTo(uint64_t frame);
+
+	/*
+	 * Registers a cursor for something reading through the file besides playback. Returns -1 if
+	 * there are too many cursors already. name must stay valid until the cursor is closed.
+	 */
+	USERET int openCursor(const char *name);
+	void closeCursor(int cursor);
+
+	/*
+	 * Tells the preloader that the cursor needs the audio from frame to frame + lookahead frames,
+	 * starting at the given time, and moves through it at framesPerSecond.
+	 */
+	void moveCursor(int cursor, uint64_t frame, unsigned lookahead, std::chrono::steady_clock::time_point deadline, float framesPerSecond);
+
+	/*
+	 * Tells the preloader that the cursor only needs the audio under a grain every strideFrames
+	 * frames, for reachFrames frames from frame. The first grain is needed by the deadline, and the
+	 * rest as the cursor gets to them at framesPerSecond. Each grain is decoded as a whole segment.
+	 */
+	void moveScrubCursor(int cursor, uint64_t frame, int64_t strideFrames, unsigned reachFrames, std::chrono::steady_clock::time_point deadline, float framesPerSecond);
+
+	// How many jumps found their audio ready, and how many had to wait for it
+	INLINE void getJumpStatistics(unsigned &hits, unsigned &misses) const {
+		hits = jumpHits.load(std::memory_order_relaxed);
+		misses = jumpMisses.load(std::memory_order_relaxed);
+	}
+
+	// How fast the file has been read ahead of the decoders, in bytes per second, or 0 if it hasn't been yet
+	USERET INLINE double getReadAheadThroughput() const { return (readAhead != NULL) ? readAhead->getThroughput() : 0.0; }
+
+	// How much memory the compressed history uses, and how many minutes of audio it holds
+	INLINE void getArchiveUsage(size_t &bytes, double &minutes) const {
+		size_t stored = 0;
+		bytes = 0;
+		if (archive != NULL) archive->getUsage(bytes, stored);
+		minutes = (double) stored / (60.0 * (double) (fileInfo.sampleRate * fileInfo.numChannels));
+	}
+
+	/*
+	 * True once a recording that was being followed is finished. Tail mode goes without the
+	 * mapping, seek index, cache, and helpers a finished file gets, so it should be reopened.
+	 */
+	INLINE USERET bool isRecordingFinished() const { return recordingEnded.load(std::memory_order_relaxed); }
 
 	INLINE USERET bool isAlive() const { return alive; }
-	INLINE USERET int err() const { return error; }
+	INLINE USERET int err() const { return error.load(std::memory_order_relaxed); }
 
 	INLINE void kill() { alive = false; }
 
+	/*
+	 * Slows the audio down on a worker thread, which keeps a ring of stretched audio
+	 * ahead of the playhead, so the audio callback only ever copies out of that ring. While the
+	 * stretcher is active, its worker is the one thread that calls readData.
+	 *
+	 * The callback asks for a new run after a jump by bumping wantRun. The worker empties the ring
+	 * and starts over from wantPosition, or finds wantPosition in what it has already slowed, then
+	 * sets haveRun to match. The callback ignores the ring until it does, and never waits on the worker.
+	 *
+	 * A change of speed doesn't start a new run. The worker hands the engine the new speed before
+	 * its next block of input, and the engine's overlap-add carries the audio smoothly from one
+	 * speed to the other. The worker marks where in the ring the new speed starts, so the callback can keep
+	 * track of where it is in the file.
+	 *
+	 * While the stretcher isn't active, the worker keeps the audio around the normal playhead
+	 * slowed ahead of time, reading it from the caches rather than readData. Slowing down, or
+	 * jumping a little way while slowed, picks up from that audio instead of starting over. Some
+	 * of the slowed audio behind the playhead is kept for the same reason.
+	 */
 	class AudioStretcher {
 	  private:
 		AudioFileReader *const reader;
-		sonicStream stretcher;
-		unsigned inPos;
-		unsigned outPos;
-		float speed;
-		const size_t bufferSize; //Uses a 3 second buffer
-
-		void trashStreamData() {
-			sonicFlushStream(stretcher);
-			const register unsigned size = sonicSamplesAvailable(stretcher);
-			float *trash = new float[size * reader->fileInfo.numChannels];
-			sonicReadFloatFromStream(stretcher, trash, size);
-			delete[] trash;
+		TimeStretcher *stretcher;
+		const size_t frameBytes;
+		const size_t requestFrames;
+		const size_t bufferFrames; // how far ahead of the input the preloader is asked to decode
+		const size_t ringFrames;
+		const size_t behindFrames; // of input, kept slowed behind the playhead
+		const size_t aheadFrames; // of input, slowed ahead of the playhead while the stretcher isn't active
+		float *ring;
+		float *block; // requestFrames frames of input read from the caches
+		float *stage; // requestFrames frames of every channel of the file
+		int cursor;
+
+		// Only touched by the callback
+		uint64_t outPos; // in frames, like everything else here
+		uint64_t runStart;
+		uint64_t runPlayed; // frames of stretched audio played since runStart
+		float speed; // of the audio being played
+
+		// Only touched by the worker
+		uint64_t inPos;
+		uint64_t renderStart; // the position of the first frame of the run
+		float runSpeed; // of the input being fed to the engine
+		bool evenSpeed; // the whole run is at runSpeed, so any position in it can be found
+
+		std::atomic<unsigned> wantRun; // written by the callback
+		std::atomic<uint64_t> wantPosition; // written by the callback
+		std::atomic<float> wantSpeed; // written by setSpeed
+		std::atomic<uint64_t> playhead; // written by follow
+		std::atomic<unsigned> haveRun; // written by the worker
+		std::atomic<uint64_t> speedChangeAt; // where in the ring nextSpeed starts. Set by the worker, cleared by the callback once it gets there.
+		std::atomic<float> nextSpeed; // written by the worker
+		std::atomic<uint64_t> written; // written by the worker
+		std::atomic<uint64_t> played; // written by the callback while active, and by the worker otherwise
+
+		std::atomic<bool> active; // written by the callback
+		std::atomic<bool> reading; // set by the worker while it may be using readData
+		std::atomic<bool> alive;
+		std::thread *thread;
+		std::mutex workLock; // held by the worker while it works
+		std::condition_variable wake;
+
+		// Where in the run the audio at position is
+		USERET INLINE uint64_t outputIndex(uint64_t position) const { return (uint64_t) ((double) (position - renderStart) / (double) runSpeed + 0.5); }
+
+		// How much slowed audio is kept behind the played part of the ring
+		USERET INLINE size_t keepFrames() const {
+			const size_t keep = (size_t) ((double) behindFrames / (double) runSpeed);
+			return (keep < ringFrames / 2) ? keep : ringFrames / 2;
 		}
 
+		void startFrom(uint64_t position, float newSpeed);
+		void startRun(unsigned run);
+		USERET bool reuse(uint64_t position);
+		USERET bool stretchSome(bool slowing);
+		void stretchLoop();
+
 	  public:
-		INLINE AudioStretcher(AudioFileReader *fileReader) : reader(fileReader), bufferSize(fileReader->fileInfo.sampleRate * fileReader->fileInfo.numChannels * 3) {
-			inPos = 0xffffffff;
-			outPos = 0xffffffff;
-			speed = 0.5f;
-			stretcher = sonicCreateStream(reader->fileInfo.sampleRate, reader->fileInfo.numChannels);
-			sonicSetSpeed(stretcher, speed);
-		}
+		AudioStretcher(AudioFileReader *fileReader, StretchEngine engine, StretchQuality quality);
+		~AudioStretcher();
 
-		INLINE unsigned copyData(void *dest, unsigned position, size_t numBytes) {
-			assert(numBytes % (sizeof(float) * reader->fileInfo.numChannels) == 0);
-			const size_t numSamples = numBytes / sizeof(float);
-			const size_t numMultiSamples = numSamples / reader->fileInfo.numChannels;
-
-			if (position != outPos) {
-				//we've skipped to a new position, so flush the buffer
-				trashStreamData();
-				inPos = position;
-				outPos = position;
-			}
-
-			//top off the buffer
-			while (inPos < outPos + bufferSize) {
-				const size_t requestMultiSamples = reader->getMaxRequestBytes() / (reader->fileInfo.numChannels * sizeof(float));
-				const size_t requestBytes = requestMultiSamples * reader->fileInfo.numChannels * sizeof(float);
-				
-				sonicWriteFloatToStream(stretcher, (float*)reader->readData(inPos, requestBytes), requestMultiSamples);
-				inPos += requestBytes / sizeof(float);
-			}
-
-			//if there aren't enough samples ready, wait for sonic to process them
-			while ((unsigned) sonicSamplesAvailable(stretcher) < numMultiSamples) std::this_thread::yield();
-			sonicReadFloatFromStream(stretcher, (float*)dest, numMultiSamples);
-			outPos += (unsigned) ((float) numSamples * speed);
-			return (unsigned) ((float) numSamples * speed);
-		}
+		/*
+		 * Copies stretched audio for the given position into dest, or silence if it isn't ready
+		 * yet. Returns how many frames of the file the audio written to dest covers. Only the audio
+		 * callback may call this, and only while the stretcher is active.
+		 */
+		HOT unsigned copyData(void *dest, uint64_t position, size_t numBytes);
 
-		INLINE void setSpeed(float slow) {
-			trashStreamData();
-			inPos = 0xffffffff;
-			outPos = 0xffffffff;
-			speed = slow;
-			sonicSetSpeed(stretcher, speed);
-		}
+		// Tells the worker where normal playback is, so it can slow the audio around it ahead of time
+		INLINE void follow(uint64_t position) { playhead.store(position, std::memory_order_relaxed); }
+
+		// Takes effect once the audio already stretched has played. Any thread may call this.
+		void setSpeed(float slow);
 
-		INLINE ~AudioStretcher() { sonicDestroyStream(stretcher); }
+		/*
+		 * Starts or stops slowed playback. Neither waits for the worker. Once started, a jump is
+		 * just a new position passed to copyData. Once stopped, the worker may still be in readData
+		 * until isReleased returns true. Only the audio callback may call these.
+		 */
+		void setActive(bool on);
+		USERET bool isReleased() const;
 	} *audioStretcher;
 
+	/*
+	 * Plays the file while rewinding and fast forwarding, as short grains taken from wherever the
+	 * playhead has got to. A worker thread copies the grains out of the caches into a small ring
+	 * ahead of the playhead, so the callback never takes a lock or waits for them. A run of grains
+	 * starts at a position and moves at a speed, and the callback starts a new one whenever the
+	 * playhead no longer matches the run. The worker moves a cursor that asks for the segment under
+	 * each grain along the way instead of everything in between, so decoding keeps up however fast
+	 * the playhead moves.
+	 */
+	class AudioScrubber {
+	  private:
+		AudioFileReader *const reader;
+		const size_t frameBytes;
+		const unsigned grainFrames;
+		const unsigned fadeFrames;
+		const unsigned grid; // grains don't cross a multiple of this many frames, so each fits in one segment
+		float *slots; // SCRUB_GRAINS grains, windowed already
+		uint64_t slotStart[SCRUB_GRAINS]; // where each grain was taken from. Written by the worker before it publishes the grain.
+		float *stage; // grainFrames frames of every channel of the file
+		int cursor;
+
+		// Only touched by the callback
+		uint64_t runFrom;
+		int runSpeed;
+		uint64_t grainIndex; // the grain of the run being played, or waited for
+		unsigned grainPlayed;
+		bool haveGrain;
+
+		// Only touched by the worker
+		uint64_t anchor;
+		int anchorSpeed;
+
+		std::atomic<unsigned> wantRun; // written by the callback
+		std::atomic<uint64_t> wantPosition; // written by the callback
+		std::atomic<int> wantSpeed; // written by the callback
+		std::atomic<unsigned> haveRun; // written by the worker
+		std::atomic<uint64_t> written; // grains of the run that are ready. Written by the worker.
+		std::atomic<uint64_t> played; // grains of the run the callback is done with. Written by the callback.
+
+		std::atomic<bool> scrubbing;
+		std::atomic<bool> alive;
+		std::thread *thread;
+		std::mutex workLock; // held by the worker while it works
+		std::condition_variable wake;
+
+		USERET INLINE float *slot(uint64_t index) const { return &slots[(size_t) (index % SCRUB_GRAINS) * grainFrames * reader->fileInfo.numChannels]; }
+
+		void nextGrain(uint64_t frame, int speed, uint64_t length);
+		USERET uint64_t grainFrame(uint64_t index, uint64_t length) const;
+		void askFor(uint64_t index, uint64_t done, uint64_t length);
+		USERET bool scrubSome();
+		void scrubLoop();
+
+	  public:
+		AudioScrubber(AudioFileReader *fileReader);
+		~AudioScrubber();
+
+		/*
+		 * Fills dest with the grains for a playhead moving from position at speed times normal speed,
+		 * which is negative going backwards. Plays silence instead if audible is false, or the grain
+		 * isn't ready yet. Either way, has the worker get the grains along the way. Only the audio
+		 * callback may call this.
+		 */
+		HOT void copyData(void *dest, uint64_t position, int speed, size_t numBytes, bool audible);
+
+		/*
+		 * Tells the worker to stop, without waiting for it. Returns where to carry on playing: just
+		 * after the grain last heard, which is decoded already. Only the audio callback may call this.
+		 */
+		USERET uint64_t finish(uint64_t position);
+	} *audioScrubber;
+
 
 };
 
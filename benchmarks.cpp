@@ -0,0 +1,287 @@
+#include "benchmarks.hpp"
+
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "audioFileReader.hpp"
+#include "config.hpp"
+#include "dictation.hpp"
+#include "sampleKernels.hpp"
+
+// How long the seek storm lasts, and how often the UI thread jumps
+static const unsigned STORM_SECONDS = 10;
+static const unsigned STORM_JUMP_MILLISECONDS = 100;
+
+// How many jumps the seek benchmark times, and how long it waits for audio after each one
+static const unsigned SEEK_COUNT = 100;
+static const unsigned SEEK_TIMEOUT_SECONDS = 5;
+
+// The latencies the decoder benchmark plays at (the range of the options slider), and how much audio it plays at each
+static const unsigned DECODER_LATENCIES[] = { 10, 20, 30, 40, 50, 60 };
+static const unsigned DECODER_SECONDS = 30;
+
+static Options benchmarkOptions() {
+	Options opt = DefaultOptions;
+	opt.cacheSize = 0;
+	opt.followRecordings = false;
+	return opt;
+}
+
+static AudioFileReader *openForBenchmark(const char *fname, unsigned latency) {
+	const Options opt = benchmarkOptions();
+	return new AudioFileReader(fname, latency, opt.historySize, opt.preloadSize, opt.cacheSize, opt.compactHistory, opt.archiveSize, opt.channelMode, false, 0, opt.stretchEngine, opt.stretchQuality);
+}
+
+// Writes the median, the 99th and 99.9th percentiles, and the worst of the times, which are in microseconds
+static void reportPercentiles(std::ostream &out, std::vector<double> &times, const char *what) {
+	if (times.empty()) {
+		out << "no samples" << std::endl;
+		return;
+	}
+	std::sort(times.begin(), times.end());
+	const size_t last = times.size() - 1;
+	out << "median " << times[last / 2] << " us, 99% " << times[last * 99 / 100] << " us, 99.9% " << times[last * 999 / 1000] << " us, worst " << times[last] << " us"
+		<< " (" << times.size() << " " << what << ")" << std::endl;
+}
+
+// How long slowed playback is timed for, and how often the UI thread changes the speed
+static const unsigned SLOW_SECONDS = 10;
+static const unsigned SLOW_CHANGE_MILLISECONDS = 250;
+
+// Samples per channel each kernel is run over at a time (small enough that the buffers stay in the cache), and for how long
+static const size_t KERNEL_SAMPLES = 16384;
+static const unsigned KERNEL_MILLISECONDS = 200;
+
+// CPU time used by every thread of the process, in seconds
+INLINE static double processSeconds() {
+	struct timespec now;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+	return (double) now.tv_sec + 1e-9 * (double) now.tv_nsec;
+}
+
+INLINE static double microsecondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+/*
+ * Plays the open file through the dictation's audio callback for the given time, calling it on the
+ * same schedule the sound server would, while another thread calls uiStep(n) every uiMilliseconds
+ * the way the UI does. Writes how long each callback took, and how many of them had sound.
+ */
+template<typename Step>
+static void timeCallbacks(Dictation &dictation, unsigned seconds, unsigned uiMilliseconds, Step uiStep, std::ostream &out) {
+	const size_t requestBytes = dictation.getMaxRequestBytes();
+	float *dest = new float[requestBytes / sizeof(float)];
+	std::vector<double> times;
+	times.reserve((size_t) seconds * 1000 / DefaultOptions.latency + 1);
+	unsigned audible = 0;
+
+	std::atomic<bool> running(true);
+	std::thread ui([&] {
+		std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+		for (unsigned n = 0; running; n++) {
+			uiStep(n);
+			next += std::chrono::milliseconds(uiMilliseconds);
+			std::this_thread::sleep_until(next);
+		}
+	});
+
+	const std::chrono::microseconds period(1000 * DefaultOptions.latency);
+	const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+	std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+	while (next < end) {
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		const size_t filled = dictation.fillBuffer(dest, requestBytes);
+		times.push_back(microsecondsSince(start));
+		if (std::any_of(dest, dest + filled / sizeof(float), [](float sample) { return sample != 0.0f; })) audible++;
+
+		next += period;
+		std::this_thread::sleep_until(next);
+	}
+	running = false;
+	ui.join();
+	dictation.closeFile();
+	delete[] dest;
+
+	out << "Time in the callback: ";
+	reportPercentiles(out, times, "callbacks");
+	out << "Callbacks with sound: " << audible << " of " << times.size() << std::endl;
+}
+
+void benchmarkSeekStorm(const char *fname, std::ostream &out) {
+	Dictation dictation;
+	dictation.openWithoutOutput(fname, benchmarkOptions());
+	dictation.play();
+
+	//jump somewhere at random, skip back and forth, and change the hot jumps, all of which take the UI's locks. Reaching the end would pause playback, so keep clear of it.
+	uint32_t random = 12345;
+	const std::vector<int> hotJumps = { -5000, 5000 };
+	timeCallbacks(dictation, STORM_SECONDS, STORM_JUMP_MILLISECONDS, [&](unsigned n) {
+		random = random * 1664525u + 1013904223u;
+		switch (n % 4) {
+			case 0: dictation.setPositionPercentage(0.9 * (double) random / 4294967296.0); break;
+			case 1: dictation.skipBack(5000); break;
+			case 2: dictation.skipForward(5000); break;
+			default: dictation.setHotJumps(hotJumps, (random & 1) != 0); break;
+		}
+	}, out);
+	out << "(" << fname << " played in " << DefaultOptions.latency << " ms callbacks, jumping every " << STORM_JUMP_MILLISECONDS << " ms for " << STORM_SECONDS << " s)" << std::endl;
+}
+
+void benchmarkSeeks(const char *fname, std::ostream &out) {
+	AudioFileReader *reader = openForBenchmark(fname, DefaultOptions.latency);
+	const AudioFileInfo &info = reader->getFileInfo();
+	const size_t requestBytes = reader->getMaxRequestBytes();
+	const uint64_t requestFrames = requestBytes / (sizeof(float) * info.numChannels);
+	const uint64_t numFrames = reader->getNumFrames();
+	if (numFrames <= requestFrames) {
+		out << "The file is too short to jump around in." << std::endl;
+		delete reader;
+		return;
+	}
+
+	std::vector<double> times;
+	times.reserve(SEEK_COUNT);
+	uint32_t random = 12345;
+	unsigned timeouts = 0;
+	for (unsigned i = 0; i < SEEK_COUNT && reader->isAlive(); i++) {
+		random = random * 1664525u + 1013904223u;
+		const uint64_t position = (uint64_t) random % (numFrames - requestFrames);
+
+		//poll like a callback that finds nothing ready would, until the audio at the new position arrives
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		const std::chrono::steady_clock::time_point giveUp = start + std::chrono::seconds(SEEK_TIMEOUT_SECONDS);
+		reader->jumpTo(position);
+		while (reader->readData(position, requestBytes) == NULL && std::chrono::steady_clock::now() < giveUp && reader->isAlive()) {
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+		}
+		if (std::chrono::steady_clock::now() >= giveUp) {
+			timeouts++;
+		} else {
+			times.push_back(microsecondsSince(start));
+		}
+	}
+	delete reader;
+
+	out << "Jumping to " << SEEK_COUNT << " random positions in " << fname << "." << std::endl;
+	out << "Time until audio is ready: ";
+	reportPercentiles(out, times, "jumps");
+	if (timeouts > 0) out << "Gave up on " << timeouts << " jumps after " << SEEK_TIMEOUT_SECONDS << " s." << std::endl;
+}
+
+void benchmarkDecoder(const char *fname, std::ostream &out) {
+	out << "CPU time per second of audio decoded from " << fname << ", counting every thread:" << std::endl;
+	for (unsigned latency : DECODER_LATENCIES) {
+		AudioFileReader *reader = openForBenchmark(fname, latency);
+		const AudioFileInfo &info = reader->getFileInfo();
+		const size_t requestBytes = reader->getMaxRequestBytes();
+		const uint64_t requestFrames = requestBytes / (sizeof(float) * info.numChannels);
+		const uint64_t numFrames = reader->getNumFrames();
+		uint64_t endFrame = (uint64_t) DECODER_SECONDS * info.sampleRate;
+		if (endFrame > numFrames) endFrame = numFrames;
+
+		//take the audio as soon as it is ready, so only the work of decoding it is counted
+		const double cpuStart = processSeconds();
+		uint64_t position = 0;
+		while (position + requestFrames <= endFrame && reader->isAlive()) {
+			if (reader->readData(position, requestBytes) != NULL) {
+				position += requestFrames;
+			} else {
+				std::this_thread::sleep_for(std::chrono::microseconds(200));
+			}
+		}
+		const double cpu = processSeconds() - cpuStart;
+		const double audioSeconds = (double) position / (double) info.sampleRate;
+		const double readAheadRate = reader->getReadAheadThroughput();
+		delete reader;
+
+		out << latency << " ms latency: ";
+		if (audioSeconds > 0.0) {
+			out << 1000.0 * cpu / audioSeconds << " ms of CPU per second (" << audioSeconds << " s of audio)";
+		} else {
+			out << "nothing decoded";
+		}
+		if (readAheadRate > 0.0) out << ", file read ahead at " << readAheadRate / 1e6 << " MB/s";
+		out << std::endl;
+	}
+}
+
+void benchmarkSlowPlayback(const char *fname, std::ostream &out) {
+	Dictation dictation;
+	dictation.openWithoutOutput(fname, benchmarkOptions());
+	dictation.slow();
+	dictation.play();
+
+	//nudge the speed down and back up, and go back to normal speed and into slow mode again every so often
+	timeCallbacks(dictation, SLOW_SECONDS, SLOW_CHANGE_MILLISECONDS, [&](unsigned n) {
+		switch (n % 8) {
+			case 3: case 7: dictation.toggleSlow(); break;
+			default: (void) dictation.increaseSlowSpeed((n % 2 == 0) ? -0.1f : 0.1f); break;
+		}
+	}, out);
+	out << "(" << fname << " played slowed from " << (int) (100.0f * DefaultOptions.slowSpeed + 0.5f) << "% speed in " << DefaultOptions.latency << " ms callbacks, changing the speed every "
+		<< SLOW_CHANGE_MILLISECONDS << " ms for " << SLOW_SECONDS << " s)" << std::endl;
+}
+
+// Runs the kernel over and over for KERNEL_MILLISECONDS, and writes how many bytes it read and wrote per second
+template<typename Kernel>
+static void reportKernel(std::ostream &out, const char *name, size_t bytesPerRun, Kernel kernel) {
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	const std::chrono::steady_clock::time_point end = start + std::chrono::milliseconds(KERNEL_MILLISECONDS);
+	uint64_t runs = 0;
+	do {
+		for (unsigned i = 0; i < 16; i++) kernel();
+		runs += 16;
+	} while (std::chrono::steady_clock::now() < end);
+	const double seconds = 1e-6 * microsecondsSince(start);
+	out << name << ": " << (double) runs * (double) bytesPerRun / seconds / 1e9 << " GB/s" << std::endl;
+}
+
+void benchmarkKernels(std::ostream &out) {
+	const size_t n = KERNEL_SAMPLES;
+	float *a = new float[2 * n];
+	float *b = new float[2 * n];
+	float *c = new float[2 * n];
+	int16_t *shorts = new int16_t[n];
+	int32_t *ints = new int32_t[n];
+	unsigned char *bytes = new unsigned char[4 * n];
+	uint32_t random = 12345;
+	for (size_t i = 0; i < 2 * n; i++) {
+		random = random * 1664525u + 1013904223u;
+		a[i] = (float) (int32_t) random * (1.0f / 2147483648.0f);
+		b[i] = -a[i];
+	}
+	for (size_t i = 0; i < n; i++) {
+		shorts[i] = (int16_t) (a[i] * 32767.0f);
+		ints[i] = (int32_t) (a[i] * 2147483647.0f);
+	}
+	for (size_t i = 0; i < 4 * n; i++) bytes[i] = (unsigned char) (i * 151);
+	volatile float sink = 0.0f; // keeps the results of the reductions from being thrown away
+
+	out << "Sample kernels over " << n << " samples per channel, counting the bytes read and written:" << std::endl;
+	reportKernel(out, "int16 (little endian) to float", n * (2 + sizeof(float)), [&]() { int16ToFloat(c, bytes, n); });
+	reportKernel(out, "int24 to float", n * (3 + sizeof(float)), [&]() { int24ToFloat(c, bytes, n); });
+	reportKernel(out, "int32 (little endian, unaligned) to float", n * (4 + sizeof(float)), [&]() { int32ToFloat(c, &bytes[1], n - 1); });
+	reportKernel(out, "int32 to float", n * (sizeof(int32_t) + sizeof(float)), [&]() { int32ToFloat(c, ints, n); });
+	reportKernel(out, "int16 (big endian) to float", n * (2 + sizeof(float)), [&]() { int16BEToFloat(c, bytes, n); });
+	reportKernel(out, "int24 (big endian) to float", n * (3 + sizeof(float)), [&]() { int24BEToFloat(c, bytes, n); });
+	reportKernel(out, "int32 (big endian) to float", n * (4 + sizeof(float)), [&]() { int32BEToFloat(c, bytes, n); });
+	reportKernel(out, "float (big endian) to float", n * (4 + sizeof(float)), [&]() { float32BEToFloat(c, bytes, n); });
+	reportKernel(out, "int16 to float", n * (sizeof(int16_t) + sizeof(float)), [&]() { int16ToFloat(c, shorts, n); });
+	reportKernel(out, "float to int16", n * (sizeof(float) + sizeof(int16_t)), [&]() { floatToInt16(shorts, a, n); });
+	reportKernel(out, "dot product", n * 2 * sizeof(float), [&]() { sink = sink + dotProduct(a, b, n); });
+	reportKernel(out, "stereo downmix", n * 3 * sizeof(float), [&]() { downmix(c, a, n, 2); });
+	reportKernel(out, "select a channel", n * 3 * sizeof(float), [&]() { selectChannel(c, a, n, 2, 1); });
+
+	delete[] a;
+	delete[] b;
+	delete[] c;
+	delete[] shorts;
+	delete[] ints;
+	delete[] bytes;
+}
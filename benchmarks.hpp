@@ -0,0 +1,41 @@
+#ifndef BENCHMARKS_HPP_
+#define BENCHMARKS_HPP_
+
+#include <ostream>
+
+/*
+ * Benchmarks for the playback paths, run from the command line. The ones that take a file open it
+ * with the default options, except that the on-disk cache is off, so the decoder does the work
+ * every time, and recordings aren't followed.
+ */
+
+/*
+ * Plays the file through the real audio callback, without a sound server, while another thread
+ * jumps around in it through the UI's calls ten times a second. Writes how long each callback took.
+ */
+void benchmarkSeekStorm(const char *fname, std::ostream &out);
+
+/*
+ * Jumps to random places in the file and writes how long it takes each time until the reader has
+ * audio for the new position.
+ */
+void benchmarkSeeks(const char *fname, std::ostream &out);
+
+/*
+ * Plays the start of the file at each latency the options allow, taking the audio as fast as it
+ * is decoded, and writes how much CPU time the process spent per second of audio, and how fast
+ * the file was read ahead of the decoders.
+ */
+void benchmarkDecoder(const char *fname, std::ostream &out);
+
+/*
+ * Plays the file slowed through the real audio callback, without a sound server, while another
+ * thread changes the speed and turns slow mode off and on through the UI's calls. Writes how long
+ * each callback took.
+ */
+void benchmarkSlowPlayback(const char *fname, std::ostream &out);
+
+// Writes how many gigabytes per second each of the sample kernels gets through, with the best instruction set the CPU has
+void benchmarkKernels(std::ostream &out);
+
+#endif /* BENCHMARKS_HPP_ */
@@ -5,7 +5,12 @@
 #include <fstream>
 #include <cstring>
 #include <cstdlib>
+#include <cstdio>
+#include <cstdint>
+#include <climits>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "attributes.hpp"
 
@@ -23,6 +28,65 @@ void touchOptionsFolder() {
 	}
 }
 
+void touchCacheFolder() {
+	// Create the ~/.cache/OpenScribe folder if it does not exist
+	struct stat unused;
+	const char *home = getenv("HOME");
+	if (home == NULL) return;
+	std::string homeDir = std::string(home);
+
+	if (stat((homeDir + "/.cache").c_str(), &unused) != 0) {
+		mkdir((homeDir + "/.cache").c_str(), 0700);
+	}
+
+	if (stat((homeDir + "/.cache/OpenScribe").c_str(), &unused) != 0) {
+		mkdir((homeDir + "/.cache/OpenScribe").c_str(), 0700);
+	}
+}
+
+INLINE static uint64_t fnv1a(uint64_t hash, const void *data, size_t bytes) {
+	const unsigned char *b = (const unsigned char*) data;
+	for (size_t i = 0; i < bytes; i++) {
+		hash ^= (uint64_t) b[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+std::string getCacheFilePath(const char *audioFilename, const char *extension) {
+	static const size_t HASHED_BYTES = 65536; // hash this much from the start and end of the file
+
+	//without a home folder there's nowhere to put the cache, so it's off
+	const char *home = getenv("HOME");
+	if (home == NULL || home[0] == '\0') return std::string();
+
+	struct stat info;
+	char realPath[PATH_MAX];
+	if (stat(audioFilename, &info) != 0 || realpath(audioFilename, realPath) == NULL) return std::string();
+
+	uint64_t key = fnv1a(0xcbf29ce484222325ull, realPath, std::strlen(realPath));
+	key = fnv1a(key, &info.st_size, sizeof(info.st_size));
+	key = fnv1a(key, &info.st_mtim, sizeof(info.st_mtim));
+
+	//Hashing the first and last 64kB is enough to tell apart two recordings with the same size and timestamp
+	int in = open(audioFilename, O_RDONLY | O_CLOEXEC);
+	if (in < 0) return std::string();
+	char *block = new char[HASHED_BYTES];
+	ssize_t got = pread(in, block, HASHED_BYTES, 0);
+	if (got > 0) key = fnv1a(key, block, (size_t) got);
+	if ((size_t) info.st_size > HASHED_BYTES) {
+		got = pread(in, block, HASHED_BYTES, info.st_size - (off_t) HASHED_BYTES);
+		if (got > 0) key = fnv1a(key, block, (size_t) got);
+	}
+	delete[] block;
+	close(in);
+	if (got < 0) return std::string();
+
+	touchCacheFolder();
+	char name[32]; std::snprintf(name, 32, "/%016llx.%s", (unsigned long long) key, extension);
+	return std::string(home) + "/.cache/OpenScribe" + name;
+}
+
 INLINE static void trim(char *str) {
 	int i = -1; while (str[++i] != '\0');
 	while (i > 0 && (str[--i] == ' ' || str[i] == '\t')) str[i] = '\0';
@@ -62,6 +126,14 @@ Options loadOptions(const Version &version) {
 		} else if (std::strcmp(line, "Slow Speed") == 0) {
 			conf >> opt.slowSpeed;
 			if (!conf.good() || opt.slowSpeed < 0.2 || opt.slowSpeed > 1.0) opt.slowSpeed = DefaultOptions.slowSpeed;
+		} else if (std::strcmp(line, "Slow Down Engine") == 0) {
+			unsigned engine;
+			conf >> engine;
+			opt.stretchEngine = (!conf.good() || engine > SONIC_STRETCHER) ? DefaultOptions.stretchEngine : (StretchEngine) engine;
+		} else if (std::strcmp(line, "Slow Down Quality") == 0) {
+			unsigned quality;
+			conf >> quality;
+			opt.stretchQuality = (!conf.good() || quality > STRETCH_BEST) ? DefaultOptions.stretchQuality : (StretchQuality) quality;
 		} else if (std::strcmp(line, "Rewind / Fast Forward Sound Effects") == 0) {
 			conf >> opt.playSoundEffects;
 			if (!conf.good()) opt.playSoundEffects = DefaultOptions.playSoundEffects;
@@ -70,15 +142,34 @@ Options loadOptions(const Version &version) {
 			if (!conf.good() || opt.latency < 10 || opt.latency > 60) opt.latency = DefaultOptions.latency;
 		} else if (std::strcmp(line, "Buffer Remember Size") == 0) {
 			conf >> opt.historySize;
-			if (!conf.good() || opt.historySize > 13 || opt.historySize == 0) opt.historySize = DefaultOptions.historySize;
+			if (!conf.good() || opt.historySize > MAX_COMPACT_HISTORY_SECONDS || opt.historySize == 0) opt.historySize = DefaultOptions.historySize;
 		} else if (std::strcmp(line, "Buffer Preprocess Size") == 0) {
 			conf >> opt.preloadSize;
 			if (!conf.good() || opt.preloadSize > 13 || opt.preloadSize == 0) opt.preloadSize = DefaultOptions.preloadSize;
+		} else if (std::strcmp(line, "Decoded Audio Cache Size") == 0) {
+			conf >> opt.cacheSize;
+			if (!conf.good() || opt.cacheSize > 8192) opt.cacheSize = DefaultOptions.cacheSize;
+		} else if (std::strcmp(line, "Compact Audio History") == 0) {
+			conf >> opt.compactHistory;
+			if (!conf.good()) opt.compactHistory = DefaultOptions.compactHistory;
+		} else if (std::strcmp(line, "Compressed History Size") == 0) {
+			conf >> opt.archiveSize;
+			if (!conf.good() || opt.archiveSize > MAX_ARCHIVE_MEGABYTES) opt.archiveSize = DefaultOptions.archiveSize;
+		} else if (std::strcmp(line, "Channel Mode") == 0) {
+			unsigned mode;
+			conf >> mode;
+			opt.channelMode = (!conf.good() || mode > RIGHT_CHANNEL) ? DefaultOptions.channelMode : (ChannelMode) mode;
+		} else if (std::strcmp(line, "Follow Growing Recordings") == 0) {
+			conf >> opt.followRecordings;
+			if (!conf.good()) opt.followRecordings = DefaultOptions.followRecordings;
 		}
 		conf.getline(line, 256, '\n');
 	}
 	conf.close();
 
+	//the longer history only fits when it's stored at 16-bit precision, which may be read after it
+	if (!opt.compactHistory && opt.historySize > MAX_HISTORY_SECONDS) opt.historySize = MAX_HISTORY_SECONDS;
+
 	bool optionsChanged = false;
 
 	if (version < Version(1,0,0)) {
@@ -110,9 +201,16 @@ void saveOptions(const Options &opt) {
 	conf << "Rewind Speed = " << opt.rewindSpeed << std::endl;
 	conf << "Fast Forward Speed = " << opt.fastForwardSpeed << std::endl;
 	conf << "Slow Speed = " << opt.slowSpeed << std::endl;
+	conf << "Slow Down Engine = " << (unsigned) opt.stretchEngine << std::endl;
+	conf << "Slow Down Quality = " << (unsigned) opt.stretchQuality << std::endl;
 	conf << "Chunk Size = " << opt.latency << std::endl;
 	conf << "Buffer Remember Size = " << opt.historySize << std::endl;
 	conf << "Buffer Preprocess Size = " << opt.preloadSize << std::endl;
+	conf << "Decoded Audio Cache Size = " << opt.cacheSize << std::endl;
+	conf << "Compact Audio History = " << opt.compactHistory << std::endl;
+	conf << "Compressed History Size = " << opt.archiveSize << std::endl;
+	conf << "Channel Mode = " << (unsigned) opt.channelMode << std::endl;
+	conf << "Follow Growing Recordings = " << opt.followRecordings << std::endl;
 	conf.close();
 }
 
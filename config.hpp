@@ -3,8 +3,11 @@
 
 #include <istream>
 #include <ostream>
+#include <string>
 
 #include "version.hpp"
+#include "sampleKernels.hpp"
+#include "timeStretcher.hpp"
 
 struct Options {
 	unsigned short rewindSpeed;
@@ -13,15 +16,39 @@ struct Options {
 
 	unsigned skipBackOnPlay;
 	float slowSpeed;
+	StretchEngine stretchEngine;
+	StretchQuality stretchQuality;
 
 	unsigned latency;
 	unsigned historySize;
 	unsigned preloadSize;
+	unsigned cacheSize; // in megabytes. 0 disables the decoded audio cache
+	bool compactHistory; // keep the history and preload buffer as 16-bit samples instead of floats
+	unsigned archiveSize; // in megabytes. 0 disables the compressed history
+
+	ChannelMode channelMode;
+	bool followRecordings; // keep playing files that are still being recorded as they grow
 };
 
-const Options DefaultOptions{ 8, 8, true, 1000, 0.5f, 25, 6, 2 };
+// Longest audio history, in seconds. Stored at 16-bit precision it takes half the memory, so it can be twice as long.
+#define MAX_HISTORY_SECONDS 13
+#define MAX_COMPACT_HISTORY_SECONDS 26
+
+// Largest compressed history, in megabytes
+#define MAX_ARCHIVE_MEGABYTES 512
+
+const Options DefaultOptions{ 8, 8, true, 1000, 0.5f, WSOLA_STRETCHER, STRETCH_BALANCED, 25, 6, 2, 2048, false, 32, ALL_CHANNELS, false };
 
 void touchOptionsFolder();
+void touchCacheFolder();
+
+/*
+ * Returns the path of the file in ~/.cache/OpenScribe that holds cached data of the given type
+ * for an audio file, or an empty string if the audio file can't be read. The name is derived
+ * from the audio file's path, size, modification time, and contents, so it changes whenever the
+ * audio file does.
+ */
+std::string getCacheFilePath(const char *audioFilename, const char *extension);
 
 Options loadOptions(const Version &version = CURRENT_VERSION);
 void saveOptions(const Options &opt);
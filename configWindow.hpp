@@ -32,6 +32,7 @@
 #include "footPedal.hpp"
 #include "simpleBar.hpp"
 #include "actions.hpp"
+#include "mainWindow.hpp"
 
 #include <cassert>
 
@@ -442,6 +443,7 @@ class ConfigWindow : public Gtk::Window {
 		}
 
 		pedals->dictationMode(configs);
+		((MainWindow*)WindowList::main)->refreshHotJumps();
 		//The fact that I do not delete each entry in configs is intentional
 		//These are copied to the FootPedalCoordinator object and later freed there
 
@@ -0,0 +1,298 @@
+#include "decoder.hpp"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include "sampleKernels.hpp"
+
+Decoder::Decoder(const char *fname, sox_format_t *opened, const SeekIndex *index, unsigned numChannels, size_t numSamples, ChannelMode channelMode, const Resampler *resampler, ReadAhead *readAhead, unsigned maxRead) {
+	size_t chars = std::strlen(fname) + 1;
+	filename = new char[chars];
+	std::memcpy(filename, fname, chars);
+
+	this->index = index;
+	this->numChannels = numChannels;
+	this->numSamples = numSamples;
+	this->channelMode = (numChannels > 1) ? channelMode : ALL_CHANNELS;
+	this->resampler = resampler;
+	this->maxRead = maxRead;
+	outChannels = (this->channelMode == ALL_CHANNELS) ? numChannels : 1;
+	maxMappedRead = (resampler != NULL) ? (unsigned) resampler->maxInputFrames(maxRead / outChannels) * outChannels : maxRead;
+	maxSourceRead = maxMappedRead / outChannels * numChannels;
+	windowStart = 0;
+	windowFrames = 0;
+	mapping = NULL;
+	mappingSize = 0;
+	fileOffset = 0;
+	head = 0;
+
+	//Indexed files are opened from a mapping, since sox_open_read scans a whole MP3 file for its length before returning
+	SeekTarget whole;
+	whole.offset = 0;
+	whole.header = NULL;
+	whole.headerBytes = 0;
+	whole.fileType = (index != NULL) ? index->getFileType() : NULL;
+	whole.discardFrames = 0;
+	audioFile = opened;
+	if (audioFile == NULL && (index == NULL || !openAt(whole))) audioFile = sox_open_read(fname, NULL, NULL, NULL);
+	if (audioFile == NULL) {
+		delete[] filename;
+		throw std::runtime_error("Error: Unable to decode audio.");
+	}
+
+	toConvert = new int[maxSourceRead];
+	stage = (this->channelMode == ALL_CHANNELS) ? NULL : new float[maxSourceRead];
+	window = (resampler != NULL) ? new float[maxMappedRead] : NULL;
+
+	this->readAhead = readAhead;
+	readAheadStream = (readAhead != NULL) ? readAhead->attach() : -1;
+	if (readAheadStream < 0) this->readAhead = NULL;
+}
+
+Decoder::~Decoder() {
+	closeFile();
+	delete[] toConvert;
+	delete[] stage;
+	delete[] window;
+	delete[] filename;
+	if (readAhead != NULL) readAhead->detach(readAheadStream);
+}
+
+void Decoder::closeFile() {
+	if (audioFile != NULL) sox_close(audioFile);
+	audioFile = NULL;
+	if (mapping != NULL) munmap(mapping, mappingSize);
+	mapping = NULL;
+}
+
+bool Decoder::reopen() {
+	closeFile();
+	audioFile = sox_open_read(filename, NULL, NULL, NULL);
+	fileOffset = 0;
+	head = 0;
+	return (audioFile != NULL);
+}
+
+/*
+ * Maps fname from start to the end of the file. The mapping is private, so the bytes in front
+ * of a frame can be overwritten with a stream header without touching the file. Returns NULL
+ * on failure. Otherwise mapping and mappingSize describe the whole mapping, which starts up to
+ * a page before start, and dataSize is the number of bytes from start to the end of the file.
+ */
+static unsigned char *mapFrom(const char *fname, size_t start, void *&mapping, size_t &mappingSize, size_t &dataSize) {
+	const size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+	const size_t pageStart = start - start % pageSize;
+
+	int fd = ::open(fname, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return NULL;
+	struct stat info;
+	if (fstat(fd, &info) != 0 || (size_t) info.st_size <= start) {
+		::close(fd);
+		return NULL;
+	}
+
+	mappingSize = (size_t) info.st_size - pageStart;
+	mapping = mmap(NULL, mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, (off_t) pageStart);
+	::close(fd);
+	if (mapping == MAP_FAILED) return NULL;
+	madvise(mapping, mappingSize, MADV_SEQUENTIAL);
+
+	dataSize = (size_t) info.st_size - start;
+	return (unsigned char*) mapping + (start - pageStart);
+}
+
+bool Decoder::probe(const char *fname, const char *fileType, sox_signalinfo_t &signal) {
+	void *probeMapping;
+	size_t probeMappingSize, dataSize;
+	unsigned char *data = mapFrom(fname, 0, probeMapping, probeMappingSize, dataSize);
+	if (data == NULL) return false;
+
+	sox_format_t *probeFile = sox_open_mem_read(data, dataSize, NULL, NULL, fileType);
+	const bool success = (probeFile != NULL && probeFile->encoding.encoding != SOX_ENCODING_UNKNOWN && probeFile->signal.rate > 0.0 && probeFile->signal.channels > 0);
+	if (success) signal = probeFile->signal;
+	if (probeFile != NULL) sox_close(probeFile);
+	munmap(probeMapping, probeMappingSize);
+	return success;
+}
+
+bool Decoder::openAt(const SeekTarget &target) {
+	//the stream header goes just in front of the first frame, so there must be room for it
+	if (target.offset < target.headerBytes) return false;
+	const size_t start = (size_t) target.offset - target.headerBytes;
+
+	void *newMapping;
+	size_t bytes, dataSize;
+	unsigned char *data = mapFrom(filename, start, newMapping, bytes, dataSize);
+	if (data == NULL) return false;
+	if (target.headerBytes > 0) std::memcpy(data, target.header, target.headerBytes);
+
+	sox_format_t *newFile = sox_open_mem_read(data, dataSize, NULL, NULL, target.fileType);
+	if (newFile == NULL) {
+		munmap(newMapping, bytes);
+		return false;
+	}
+
+	closeFile();
+	audioFile = newFile;
+	mapping = newMapping;
+	mappingSize = bytes;
+	fileOffset = start;
+	return true;
+}
+
+bool Decoder::seek(size_t at) {
+	SeekTarget target;
+	if (index != NULL && index->locate(at / numChannels, target) && openAt(target)) {
+		reportPosition();
+
+		//decode and throw away the pre-roll
+		size_t discard = (size_t) target.discardFrames * numChannels + at % numChannels;
+		while (discard > 0) {
+			const size_t read = sox_read(audioFile, toConvert, (discard < maxSourceRead) ? discard : maxSourceRead);
+			if (read == 0) break;
+			discard -= read;
+		}
+		if (discard == 0) {
+			head = at;
+			return true;
+		}
+	}
+
+	//SoX can only seek in files it opened itself
+	if (mapping != NULL && !reopen()) return false;
+	const bool success = (sox_seek(audioFile, at, SOX_SEEK_SET) == SOX_SUCCESS);
+	if (success) head = at;
+	reportPosition();
+	return success;
+}
+
+unsigned Decoder::readMore(float *dest, size_t at, unsigned count) {
+	if (audioFile == NULL || resampler != NULL) return 0;
+	if (count > maxMappedRead) count = maxMappedRead;
+	const size_t sourceAt = at / outChannels * numChannels;
+	const unsigned sourceCount = count / outChannels * numChannels;
+	if (head != sourceAt && !seek(sourceAt)) return 0;
+
+	//SoX remembers that it hit the end of the file last time, so make it look again
+	if (audioFile->fp != NULL) clearerr((FILE*) audioFile->fp);
+	const size_t read = sox_read(audioFile, toConvert, sourceCount);
+	reportPosition();
+	head += read;
+	if (head > numSamples) numSamples = head;
+
+	//The writer may be partway through a frame. Leave it out, and read it again from the start next time.
+	const size_t whole = read - read % numChannels;
+	if (whole != read) head = (size_t) -1;
+
+	if (channelMode == ALL_CHANNELS) {
+		int32ToFloat(dest, toConvert, whole);
+		return (unsigned) whole;
+	}
+	int32ToFloat(stage, toConvert, whole);
+	mapChannels(dest, stage, whole / numChannels, numChannels, channelMode);
+	return (unsigned) (whole / numChannels);
+}
+
+bool Decoder::restart(size_t at) {
+	if (!reopen()) return false;
+	return seek(at / outChannels * numChannels);
+}
+
+HOT bool Decoder::read(float *dest, size_t at, unsigned count) {
+	if (resampler == NULL) return readMapped(dest, at, count);
+
+	if (count > maxRead) count = maxRead;
+	const size_t first = at / outChannels;
+	const unsigned numFrames = count / outChannels;
+	const int64_t from = resampler->firstInput(first);
+	const int64_t to = resampler->endInput(first + numFrames);
+
+	//keep whatever part of the window the new read still needs, so reading straight through never seeks back
+	if (from >= windowStart && from <= windowStart + (int64_t) windowFrames) {
+		const size_t keep = (size_t) (windowStart + (int64_t) windowFrames - from);
+		std::memmove((void*) window, (const void*) &window[(size_t) (from - windowStart) * outChannels], keep * outChannels * sizeof(float));
+		windowFrames = keep;
+	} else {
+		windowFrames = 0;
+	}
+	windowStart = from;
+
+	bool success = true;
+	while (windowStart + (int64_t) windowFrames < to) {
+		const int64_t next = windowStart + (int64_t) windowFrames;
+		float *input = &window[windowFrames * outChannels];
+		if (next < 0) {
+			//the filter reaches back past the start of the file
+			const size_t silence = (size_t) ((to < 0) ? to - next : -next);
+			std::memset((void*) input, 0, silence * outChannels * sizeof(float));
+			windowFrames += silence;
+		} else {
+			const size_t numInput = (size_t) (to - next);
+			success &= readMapped(input, (size_t) next * outChannels, (unsigned) (numInput * outChannels));
+			windowFrames += numInput;
+		}
+	}
+
+	resampler->process(dest, first, numFrames, window, windowStart);
+	if (count > numFrames * outChannels) std::memset((void*) &dest[numFrames * outChannels], 0, (count - numFrames * outChannels) * sizeof(float));
+	return success;
+}
+
+HOT bool Decoder::readMapped(float *dest, size_t at, unsigned count) {
+	if (channelMode == ALL_CHANNELS) return readSource(dest, at, count);
+
+	if (count > maxMappedRead) count = maxMappedRead;
+	const bool success = readSource(stage, at * numChannels, count * numChannels);
+	mapChannels(dest, stage, count, numChannels, channelMode);
+	return success;
+}
+
+HOT bool Decoder::readSource(float *dest, size_t at, unsigned count) {
+	if (count > maxSourceRead) count = maxSourceRead;
+
+	bool retry = false;
+	size_t read = 0;
+	do {
+		if (audioFile != NULL && head != at && !seek(at)) {
+			//file head is not where we want to read, and we can't get it there
+			std::memset((void*) dest, 0, count * sizeof(float));
+			return false;
+		}
+		read = (audioFile != NULL) ? sox_read(audioFile, toConvert, count) : 0;
+		reportPosition();
+
+		//SoX reads in signed 32-bit integer format, but I want floating point format. Convert it.
+		int32ToFloat(dest, toConvert, read);
+
+		head += read;
+		if (numSamples != 0 && head > numSamples) head = numSamples;
+
+		/*
+		 * When seeking to or from the end of an audio file, SoX will stop reading data from the file.
+		 * Until I find a better library, I'll work around this by closing the file and opening it again
+		 * If we immediately fail again, then an actual error occurred.
+		 */
+		if (read == 0 && at < numSamples) {
+			if (retry) {
+				//Okay, something actually went wrong here
+				std::memset((void*) dest, 0, count * sizeof(float));
+				return false;
+			}
+
+			// "have you tried turning it off and on again?"
+			if (!reopen() || !seek(at)) {
+				std::memset((void*) dest, 0, count * sizeof(float));
+				return false;
+			}
+			retry = true;
+		} else break;
+	} while (true);
+
+	if (read < count) std::memset((void*) &dest[read], 0, (count - read) * sizeof(float));
+	return true;
+}
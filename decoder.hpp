@@ -0,0 +1,101 @@
+#ifndef DECODER_HPP_
+#define DECODER_HPP_
+
+#include <cstddef>
+#include <sox.h>
+
+#include "attributes.hpp"
+#include "seekIndex.hpp"
+#include "sampleKernels.hpp"
+#include "resampler.hpp"
+#include "readAhead.hpp"
+
+/*
+ * Decodes a compressed audio file with SoX, tracking where the decoder is in the file.
+ *
+ * If a seek index is available and ready, seeks open a new decoder directly at the right
+ * frame (from a private copy-on-write mapping of the file) instead of asking SoX to seek.
+ *
+ * Unless every channel is played, the channels are mixed or one is picked as the audio is
+ * decoded, and positions count mono samples. With a resampler, positions count samples at the
+ * output rate. The input frames around the last read are kept, so reading straight through
+ * the file never seeks.
+ */
+class Decoder {
+  private:
+	char *filename;
+	sox_format_t *audioFile;
+	const SeekIndex *index;
+	unsigned numChannels;
+	size_t numSamples;
+	ChannelMode channelMode;
+	unsigned outChannels;
+	const Resampler *resampler;
+	unsigned maxRead;
+	unsigned maxMappedRead;
+	unsigned maxSourceRead;
+	int *toConvert;
+	float *stage; // whole frames, before the channels are mapped
+
+	// Input frames for the resampler, after the channels are mapped
+	float *window;
+	int64_t windowStart;
+	size_t windowFrames;
+	size_t head;
+
+	void *mapping; // the file mapping audioFile is decoding from, or NULL if SoX opened the file itself
+	size_t mappingSize;
+	size_t fileOffset; // where in the file audioFile starts
+
+	ReadAhead *readAhead;
+	int readAheadStream;
+
+	INLINE void reportPosition() {
+		if (readAhead != NULL && audioFile != NULL) readAhead->update(readAheadStream, fileOffset + (size_t) audioFile->tell_off);
+	}
+
+	void closeFile();
+	USERET bool reopen();
+	USERET bool openAt(const SeekTarget &target);
+	USERET bool seek(size_t at);
+	USERET HOT bool readSource(float *dest, size_t at, unsigned count);
+	USERET HOT bool readMapped(float *dest, size_t at, unsigned count);
+
+  public:
+	/*
+	 * opened may be a SoX handle that was already opened on fname, which the decoder takes
+	 * ownership of, or NULL. index, resampler, and readAhead may be NULL. numChannels and numSamples
+	 * describe the file itself, and numSamples may be 0 if the length isn't known yet. No more than
+	 * maxRead samples are read at once.
+	 */
+	Decoder(const char *fname, sox_format_t *opened, const SeekIndex *index, unsigned numChannels, size_t numSamples, ChannelMode channelMode, const Resampler *resampler, ReadAhead *readAhead, unsigned maxRead);
+	~Decoder();
+
+	/*
+	 * Reads the format of fname the way a decoder with a seek index opens it, which doesn't make
+	 * SoX scan the whole file for its length. The length is left 0 if the file's header doesn't
+	 * give it. Returns false if SoX can't decode the file.
+	 */
+	USERET static bool probe(const char *fname, const char *fileType, sox_signalinfo_t &signal);
+
+	// Tells the decoder how many samples the file has, once that is known
+	INLINE void setLength(size_t numSamples) { this->numSamples = numSamples; }
+
+	/*
+	 * Reads count samples starting at the interleaved sample position at into dest. Anything past
+	 * the end of the file is filled with silence. Returns false if the file could not be read.
+	 */
+	USERET HOT bool read(float *dest, size_t at, unsigned count);
+
+	/*
+	 * For files that are still being written. Reads up to count samples starting at at, which should
+	 * be where the audio decoded so far ends, and returns how many there were, in whole frames. Nothing
+	 * is filled with silence. Doesn't resample.
+	 */
+	USERET unsigned readMore(float *dest, size_t at, unsigned count);
+
+	// Opens the file again and seeks to at, for when SoX won't read past where the file used to end
+	USERET bool restart(size_t at);
+};
+
+#endif /* DECODER_HPP_ */
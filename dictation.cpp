@@ -3,7 +3,69 @@
 #include <cstring>
 #include <cassert>
 
-void Dictation::openFile(const char *fname, const Options &opt) {
+// How often the paused loop thread checks whether the stretcher has finished with the reader
+static const int RELEASE_POLL_MILLISECONDS = 5;
+
+struct SinkRateQuery {
+	unsigned rate;
+	bool done;
+};
+
+static void onSinkInfo(pa_context*, const pa_sink_info *info, int eol, void *userdata) {
+	SinkRateQuery *query = (SinkRateQuery*) userdata;
+	if (eol == 0 && info != NULL) {
+		query->rate = info->sample_spec.rate;
+	} else {
+		query->done = true;
+	}
+}
+
+static void onServerInfo(pa_context *context, const pa_server_info *info, void *userdata) {
+	SinkRateQuery *query = (SinkRateQuery*) userdata;
+	if (info == NULL) {
+		query->done = true;
+		return;
+	}
+
+	//the server's default rate will do if we can't find out about the sink itself
+	query->rate = info->sample_spec.rate;
+	pa_operation *operation = (info->default_sink_name != NULL) ? pa_context_get_sink_info_by_name(context, info->default_sink_name, onSinkInfo, userdata) : NULL;
+	if (operation == NULL) {
+		query->done = true;
+	} else {
+		pa_operation_unref(operation);
+	}
+}
+
+// Asks PulseAudio what rate the default sink runs at. Returns 0 if it can't be found out.
+static unsigned getSinkRate() {
+	SinkRateQuery query = { 0, false };
+	pa_mainloop *loop = pa_mainloop_new();
+	pa_context *context = pa_context_new(pa_mainloop_get_api(loop), "OpenScribe Rate Query");
+
+	if (context != NULL && pa_context_connect(context, NULL, PA_CONTEXT_NOFLAGS, NULL) >= 0) {
+		int unused;
+		pa_context_state_t state;
+		while ((state = pa_context_get_state(context)) != PA_CONTEXT_READY && PA_CONTEXT_IS_GOOD(state)) pa_mainloop_iterate(loop, true, &unused);
+
+		pa_operation *operation = (state == PA_CONTEXT_READY) ? pa_context_get_server_info(context, onServerInfo, &query) : NULL;
+		if (operation != NULL) {
+			pa_operation_unref(operation);
+			while (!query.done && pa_mainloop_iterate(loop, true, &unused) >= 0);
+		}
+		pa_context_disconnect(context);
+	}
+
+	if (context != NULL) pa_context_unref(context);
+	pa_mainloop_free(loop);
+	return query.rate;
+}
+
+// Opens the reader and sets up the transport for it, resampling to outputRate unless it's 0
+void Dictation::loadFile(const char *fname, const Options &opt, unsigned outputRate) {
+	//watching the file for a recording takes a moment, so do it before taking the locks
+	const bool recording = opt.followRecordings && AudioFileReader::isBeingRecorded(fname);
+
 	writeLock.lock();
 	readLock.lock();
 
@@ -14,19 +76,15 @@ void Dictation::openFile(const char *fname, const Options &opt) {
 	}
 
 	try {
-		reader = new AudioFileReader(fname, opt.latency, opt.historySize, opt.preloadSize);
-	} catch (const std::invalid_argument &ex) {
+		reader = new AudioFileReader(fname, opt.latency, opt.historySize, opt.preloadSize, opt.cacheSize, opt.compactHistory, opt.archiveSize, opt.channelMode, recording, outputRate, opt.stretchEngine, opt.stretchQuality);
+	} catch (...) {
 		readLock.unlock();
 		writeLock.unlock();
-		throw ex;
+		throw;
 	}
-	const size_t BUFFER_BYTES = reader->getMaxRequestBytes();
-	BUFFER_FRAMES = BUFFER_BYTES / sizeof(float);
-
-	pa_sample_spec sampleFormat;
-	sampleFormat.format = PA_SAMPLE_FLOAT32LE;
-	sampleFormat.rate = reader->getFileInfo().sampleRate;
-	sampleFormat.channels = reader->getFileInfo().numChannels;
+	applyHotJumps();
+	FRAME_BYTES = sizeof(float) * reader->getFileInfo().numChannels;
+	BUFFER_FRAMES = reader->getMaxRequestBytes() / FRAME_BYTES;
 
 	readLock.unlock();
 	writeLock.unlock();
@@ -35,14 +93,29 @@ void Dictation::openFile(const char *fname, const Options &opt) {
 	FFWD_SPEED = opt.fastForwardSpeed;
 	SFX = opt.playSoundEffects;
 	slowSpeed = opt.slowSpeed;
-	genFX();
+	reader->audioStretcher->setSpeed(slowSpeed);
+	stretcherOn = false;
+	stretcherStopping = false;
+	scrubbed = false;
 
 	position = 0;
+	seekTo = NO_SEEK;
 	paused = true;
 
 	const size_t fnl = std::strlen(fname)+1;
 	fileName = new char[fnl];
 	std::memcpy(fileName, fname, fnl);
+}
+
+void Dictation::openFile(const char *fname, const Options &opt) {
+	//ask before taking the locks, since it means waiting on the sound server
+	loadFile(fname, opt, getSinkRate());
+	const size_t BUFFER_BYTES = BUFFER_FRAMES * FRAME_BYTES;
+
+	pa_sample_spec sampleFormat;
+	sampleFormat.format = PA_SAMPLE_FLOAT32LE;
+	sampleFormat.rate = reader->getFileInfo().sampleRate;
+	sampleFormat.channels = reader->getFileInfo().numChannels;
 
 	pa_buffer_attr bufferInfo;
 	bufferInfo.maxlength = 2*BUFFER_BYTES;
@@ -71,6 +144,10 @@ void Dictation::openFile(const char *fname, const Options &opt) {
 	loopThread = new std::thread(&Dictation::mainloop, this);
 }
 
+void Dictation::openWithoutOutput(const char *fname, const Options &opt) {
+	loadFile(fname, opt, 0);
+}
+
 void Dictation::closeFile() {
 	writeLock.lock();
 	readLock.lock();
@@ -91,17 +168,19 @@ void Dictation::closeFile() {
 		pa_context_unref(paContext);
 
 		pa_mainloop_free(paLoop);
+		audioStream = NULL;
+	}
 
-		writeLock.lock();
-		readLock.lock();
-		delete[] fileName;
-		delete[] SFX_RWD;
-		delete[] SFX_FFWD;
+	writeLock.lock();
+	readLock.lock();
+	//the loop thread deletes the reader, so it's only left if the file was opened without output
+	delete reader;
+	reader = NULL;
+	delete[] fileName;
 
-		fileName = NULL;
-		readLock.unlock();
-		writeLock.unlock();
-	}
+	fileName = NULL;
+	readLock.unlock();
+	writeLock.unlock();
 }
 
 HOT void Dictation::fetchAudioData(pa_stream *stream, size_t bytes, void *myself) {
@@ -109,85 +188,93 @@ HOT void Dictation::fetchAudioData(pa_stream *stream, size_t bytes, void *myself
 
 	void *data;
 	pa_stream_begin_write(stream, &data, &bytes);
+	const size_t written = me->fillBuffer(data, bytes);
+	if (written == 0) {
+		pa_stream_cancel_write(stream);
+	} else {
+		pa_stream_write(stream, data, written, NULL, 0, PA_SEEK_RELATIVE);
+	}
+}
 
-	me->writeLock.lock();
-	if (me->reader == NULL || !me->reader->isAlive()) {
+HOT size_t Dictation::fillBuffer(void *data, size_t bytes) {
+	//only the thread running the callback deletes the reader, so it can't go away while we use it
+	if (reader == NULL || !reader->isAlive()) {
 		std::memset(data, 0, bytes);
-		pa_stream_write(stream, data, bytes, NULL, 0, PA_SEEK_RELATIVE);
-		me->writeLock.unlock();
-		return;
+		return bytes;
 	}
 
-	size_t request = bytes / sizeof(float);
-	request -= request % me->reader->getFileInfo().numChannels;
+	size_t request = bytes / FRAME_BYTES;
 	if (request == 0) {
-		pa_stream_cancel_write(stream);
-		me->writeLock.unlock();
-		return;
-	} else if (request > me->BUFFER_FRAMES) {
-		request = me->BUFFER_FRAMES;
+		return 0;
+	} else if (request > BUFFER_FRAMES) {
+		request = BUFFER_FRAMES;
 	}
-	const size_t requestBytes = request * sizeof(float);
+	const size_t requestBytes = request * FRAME_BYTES;
 
-	if (me->position > me->reader->getFileInfo().numSamples) {
-		me->readLock.lock();
-		me->position = me->reader->getFileInfo().numSamples;
-		me->paused = true;
-		me->readLock.unlock();
-	}
+	const Mode playing = mode.load(std::memory_order_relaxed);
+	applyCommands(playing);
+	uint64_t at = position.load(std::memory_order_relaxed);
 
-	if (me->mode == REWIND) {
-		if (me->SFX) {
-			std::memcpy(data, (void*)me->SFX_RWD, requestBytes);
-		} else {
-			std::memset(data, 0, requestBytes);
-		}
+	//keep slowed audio ready around wherever normal playback is
+	if (playing == NORMAL && !stretcherOn) reader->audioStretcher->follow(at);
 
-		me->readLock.lock();
-		if (me->position < request * me->RWD_SPEED) {
-			me->position = 0;
-		} else {
-			me->position -= request * me->RWD_SPEED;
-		}
-		me->readLock.unlock();
-	} else if (me->mode == FAST_FORWARD) {
-		if (me->SFX) {
-			std::memcpy(data, (void*)me->SFX_FFWD, requestBytes);
+	if (playing == REWIND) {
+		reader->audioScrubber->copyData(data, at, -(int) RWD_SPEED, requestBytes, SFX);
+		if (at < request * RWD_SPEED) {
+			at = 0;
 		} else {
-			std::memset(data, 0, requestBytes);
+			at -= request * RWD_SPEED;
 		}
-		me->readLock.lock();
-		me->position += request * me->FFWD_SPEED;
-		me->readLock.unlock();
-	} else if (me->paused) {
+	} else if (playing == FAST_FORWARD) {
+		reader->audioScrubber->copyData(data, at, (int) FFWD_SPEED, requestBytes, SFX);
+		at += request * FFWD_SPEED;
+	} else if (paused.load(std::memory_order_relaxed)) {
 		std::memset(data, 0, requestBytes);
-	} else if (me->slowed && me->slowSpeed != 1.0f) {
-		me->readLock.lock();
-		me->position += me->reader->audioStretcher->copyData(data, me->position, requestBytes);
-		me->readLock.unlock();
-	} else {
-		me->reader->copyData(data, me->position, requestBytes);
-		me->readLock.lock();
-		me->position += request;
-		me->readLock.unlock();
+	} else if (stretcherOn) {
+		at += reader->audioStretcher->copyData(data, at, requestBytes);
+	} else if (stretcherStopping) {
+		//the stretcher's worker may still be reading the file
+		std::memset(data, 0, requestBytes);
+	} else if (reader->copyData(data, at, requestBytes)) {
+		//if the data isn't decoded yet, copyData plays silence and we stay where we are
+		at += request;
 	}
-
-	me->writeLock.unlock();
-	pa_stream_write(stream, data, requestBytes, NULL, 0, PA_SEEK_RELATIVE);
+	position.store(at, std::memory_order_relaxed);
+	return requestBytes;
 }
 
-void Dictation::genFX() {
-	SFX_RWD = new float[BUFFER_FRAMES];
-	SFX_FFWD = new float[BUFFER_FRAMES];
+/*
+ * Makes the changes the UI has asked for since the last callback: ending a scrub, jumping, and
+ * starting or stopping the stretcher. Only the loop thread calls this, from the callback, or while
+ * paused, so jumps still reach the reader ahead of playback.
+ */
+void Dictation::applyCommands(Mode playing) {
+	uint64_t at = position.load(std::memory_order_relaxed);
+	bool jumped = false;
+
+	//carry on from the last grain once the rewind or fast forward is released
+	if (scrubbed && playing == NORMAL) {
+		at = reader->audioScrubber->finish(at);
+		jumped = true;
+	}
+	scrubbed = (playing != NORMAL);
 
-	unsigned const &CHANNELS = reader->getFileInfo().numChannels;
+	const uint64_t seek = seekTo.exchange(NO_SEEK, std::memory_order_acquire);
+	if (seek != NO_SEEK) {
+		at = seek;
+		jumped = true;
+	}
 
-	for (unsigned i = 0; i < BUFFER_FRAMES; i += CHANNELS) {
-		for (unsigned j = 0; j < CHANNELS; j++) {
-			SFX_RWD[i+j] = 0.125f * (i % 100 / 100.f - 0.5);
-			SFX_FFWD[i+j] = 0.125f * (i % 80 / 80.f - 0.5);
-		}
+	const uint64_t length = reader->getNumFrames();
+	if (at > length) {
+		at = length;
+		paused = true;
 	}
+	position.store(at, std::memory_order_relaxed);
+
+	updateStretcher();
+	//the stretcher notices the new position itself, and a stopping one is caught up once it's done
+	if (jumped && !stretcherOn && !stretcherStopping) reader->jumpTo(at);
 }
 
 HOT void Dictation::mainloop() {
@@ -195,7 +282,15 @@ HOT void Dictation::mainloop() {
 	std::unique_lock<std::mutex> wLock(writeLock, std::defer_lock);
 	while (true) {
 		wLock.lock();
-		while (paused && mode == NORMAL && reader != NULL && reader->isAlive()) pauseWait.wait(wLock);
+		while (paused && mode == NORMAL && reader != NULL && reader->isAlive()) {
+			//the callback isn't running, so make the jumps it would have, and check back while the stretcher stops
+			applyCommands(NORMAL);
+			if (stretcherStopping) {
+				pauseWait.wait_for(wLock, std::chrono::milliseconds(RELEASE_POLL_MILLISECONDS));
+			} else {
+				pauseWait.wait(wLock);
+			}
+		}
 
 		if (reader == NULL) {
 			break;
@@ -255,10 +350,13 @@ float Dictation::increaseSlowSpeed(float dv) {
 	writeLock.lock();
 	readLock.lock();
 
-	slowSpeed += dv;
-	if (slowSpeed < 0.2) slowSpeed = 0.2;
-	if (slowSpeed > 1.0) slowSpeed = 1.0;
-	ret = slowSpeed;
+	ret = slowSpeed + dv;
+	if (ret < 0.2) ret = 0.2;
+	if (ret > 1.0) ret = 1.0;
+	slowSpeed = ret;
+	if (reader != NULL && reader->isAlive()) {
+		reader->audioStretcher->setSpeed(ret);
+	}
 
 	readLock.unlock();
 	writeLock.unlock();
@@ -271,13 +369,13 @@ void Dictation::setPositionMilliseconds(unsigned ms) {
 	readLock.lock();
 
 	if (reader != NULL && reader->isAlive()) {
-		pa_stream_flush(audioStream, NULL, NULL);
-		position = (unsigned)(((double)ms/1000.0) * (double)reader->getFileInfo().sampleRate * (double)reader->getFileInfo().numChannels + 0.5);
-		position -= position % reader->getFileInfo().numChannels;
+		if (audioStream != NULL) pa_stream_flush(audioStream, NULL, NULL);
+		seekTo.store((uint64_t)(((double)ms/1000.0) * (double)reader->getFileInfo().sampleRate + 0.5), std::memory_order_release);
 	}
 
 	readLock.unlock();
 	writeLock.unlock();
+	pauseWait.notify_all();
 }
 
 void Dictation::setPositionPercentage(double p) {
@@ -288,37 +386,104 @@ void Dictation::setPositionPercentage(double p) {
 	else if (p > 1.0) { p = 1.0; }
 
 	if (reader != NULL && reader->isAlive()) {
-		pa_stream_flush(audioStream, NULL, NULL);
-		position = (unsigned)(p*(double)reader->getFileInfo().numSamples + 0.5);
-		position -= position % reader->getFileInfo().numChannels;
+		if (audioStream != NULL) pa_stream_flush(audioStream, NULL, NULL);
+		seekTo.store((uint64_t)(p*(double)reader->getNumFrames() + 0.5), std::memory_order_release);
 	}
 
 	readLock.unlock();
 	writeLock.unlock();
+	pauseWait.notify_all();
 }
 
 void Dictation::skipForward(int ms) {
 	writeLock.lock();
 	readLock.lock();
 
-	if (ms == 0 || reader == NULL || !reader->isAlive()) {
-		/* Do nothing */
-	} else if (ms < 0) {
-		const unsigned back = (unsigned) (reader->getFileInfo().sampleRate * reader->getFileInfo().numChannels * (unsigned)((double)-ms/1000.0));
-		if (back >= position) {
-			position = 0;
+	if (ms != 0 && reader != NULL && reader->isAlive()) {
+		//skip from wherever the last skip went, even if the callback hasn't made it yet
+		const uint64_t pending = seekTo.load(std::memory_order_relaxed);
+		uint64_t target = (pending != NO_SEEK) ? pending : position.load(std::memory_order_relaxed);
+		if (ms < 0) {
+			const uint64_t back = (uint64_t) reader->getFileInfo().sampleRate * (unsigned)((double)-ms/1000.0);
+			if (back >= target) {
+				target = 0;
+			} else {
+				target -= back;
+			}
 		} else {
-			position -= back;
-		}
-	} else {
-		position += (unsigned) (reader->getFileInfo().sampleRate * reader->getFileInfo().numChannels * (unsigned)((double)ms/1000.0));
-		if (position > reader->getFileInfo().numSamples) {
-			position = reader->getFileInfo().numSamples;
+			target += (uint64_t) reader->getFileInfo().sampleRate * (unsigned)((double)ms/1000.0);
+			const uint64_t length = reader->getNumFrames();
+			if (target > length) {
+				target = length;
+			}
 		}
+		seekTo.store(target, std::memory_order_release);
 	}
 
 	readLock.unlock();
 	writeLock.unlock();
+	pauseWait.notify_all();
+}
+
+void Dictation::setHotJumps(const std::vector<int> &milliseconds, bool restart) {
+	writeLock.lock();
+	readLock.lock();
+
+	hotJumps = milliseconds;
+	hotRestart = restart;
+	if (reader != NULL) applyHotJumps();
+
+	readLock.unlock();
+	writeLock.unlock();
+}
+
+/*
+ * Starts or stops the stretcher to match the slow setting, without waiting for its worker.
+ * Once stopped, the worker may still be reading the file, so the callback plays silence until it
+ * has finished. Only the loop thread calls this.
+ */
+void Dictation::updateStretcher() {
+	const bool stretch = isStretching();
+	if (stretch != stretcherOn) {
+		stretcherOn = stretch;
+		reader->audioStretcher->setActive(stretch);
+		stretcherStopping = !stretch;
+	}
+	if (stretcherStopping && reader->audioStretcher->isReleased()) {
+		stretcherStopping = false;
+		//the worker has been reading ahead of us, so get the reader back to where we are
+		reader->jumpTo(position);
+	}
+}
+
+// converts the hot jumps to frame offsets the same way skipForward does. Call with the locks held.
+void Dictation::applyHotJumps() {
+	const unsigned framesPerSecond = reader->getFileInfo().sampleRate;
+	std::vector<int> offsets;
+	for (int ms : hotJumps) {
+		const int seconds = (int) ((double) ms / 1000.0);
+		offsets.push_back(seconds * (int) framesPerSecond);
+	}
+	reader->setHotOffsets(offsets, hotRestart);
+}
+
+void Dictation::getJumpStatistics(unsigned &hits, unsigned &misses) const {
+	std::unique_lock<std::mutex> rLock(readLock);
+	if (reader == NULL) {
+		hits = misses = 0;
+	} else {
+		reader->getJumpStatistics(hits, misses);
+	}
+}
+
+void Dictation::getArchiveUsage(size_t &bytes, double &minutes) const {
+	std::unique_lock<std::mutex> rLock(readLock);
+	if (reader == NULL) {
+		bytes = 0;
+		minutes = 0.0;
+	} else {
+		reader->getArchiveUsage(bytes, minutes);
+	}
 }
 
 
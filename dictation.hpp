@@ -4,15 +4,21 @@
 #include "audioFileReader.hpp"
 #include "config.hpp"
 
+#include <atomic>
 #include <mutex>
+#include <vector>
 
 extern "C" {
 #include <pulse/stream.h>
 #include <pulse/sample.h>
 #include <pulse/def.h>
 #include <pulse/mainloop.h>
+#include <pulse/context.h>
+#include <pulse/introspect.h>
 }
 
+#define NO_SEEK UINT64_MAX
+
 class Dictation {
   private:
 	AudioFileReader *reader;
@@ -23,42 +29,63 @@ class Dictation {
 	unsigned short FFWD_SPEED;
 	bool SFX;
 
+	unsigned FRAME_BYTES;
 	unsigned BUFFER_FRAMES;
 
-	float *SFX_RWD;
-	float *SFX_FFWD;
-
 	std::thread *loopThread;
 	pa_stream *audioStream;
 	pa_mainloop *paLoop;
 	pa_context *paContext;
 
-	unsigned position;
-	float slowSpeed;
-	bool paused;
-	bool slowed;
+	enum PACKED Mode {
+		REWIND,
+		NORMAL,
+		FAST_FORWARD
+	};
+
+	/*
+	 * The transport. The callback never takes a lock, so the UI only stores to these, and asks for
+	 * jumps through seekTo, which the callback picks up and makes on its own thread. Only the
+	 * callback moves position, except before the stream starts.
+	 */
+	std::atomic<uint64_t> position; // in frames
+	std::atomic<uint64_t> seekTo; // where the UI has asked to jump to, or NO_SEEK
+	std::atomic<float> slowSpeed;
+	std::atomic<bool> paused;
+	std::atomic<bool> slowed;
+	std::atomic<Mode> mode;
+
+	// Only touched by the loop thread, or before the stream starts
+	bool stretcherOn; // the stretcher is active, so its worker reads the file
+	bool stretcherStopping; // the stretcher has been stopped, but its worker may still be reading the file
+	bool scrubbed; // the last audio played came from the scrubber
 
 	char *fileName;
 
+	std::vector<int> hotJumps; // in milliseconds
+	bool hotRestart;
+
 	mutable std::mutex readLock;
 	std::mutex writeLock;
 	std::condition_variable pauseWait;
 
-	enum PACKED {
-		REWIND,
-		NORMAL,
-		FAST_FORWARD
-	} mode;
-
 	HOT static void fetchAudioData(pa_stream *stream, size_t bytes, void *myself);
-	void genFX();
+
+	void loadFile(const char *fname, const Options &opt, unsigned outputRate);
 
 	HOT void mainloop();
+	void applyHotJumps();
+	void applyCommands(Mode playing);
+	void updateStretcher();
+
+	// True if the callback should play slowed audio from the stretcher instead of reading the file itself
+	USERET INLINE bool isStretching() const { return slowed && slowSpeed != 1.0f; }
 
   public:
 	INLINE Dictation() :
-		reader(NULL), RWD_SPEED(8), FFWD_SPEED(8), SFX(true), SFX_RWD(NULL), SFX_FFWD(NULL),
-		loopThread(NULL), position(0), slowSpeed(0.5f), paused(true), slowed(false), fileName(NULL), mode(NORMAL) { onReaderError = NULL; }
+		reader(NULL), RWD_SPEED(8), FFWD_SPEED(8), SFX(true),
+		loopThread(NULL), audioStream(NULL), position(0), seekTo(NO_SEEK), slowSpeed(0.5f), paused(true), slowed(false), mode(NORMAL),
+		stretcherOn(false), stretcherStopping(false), scrubbed(false), fileName(NULL), hotRestart(false) { onReaderError = NULL; }
 	INLINE ~Dictation() { closeFile(); }
 
 	INLINE void connectErrorHandler(void (*errorHandler)(int)) {
@@ -69,12 +96,21 @@ class Dictation {
 
 	void openFile(const char *fname, const Options &opt);
 	void closeFile();
+
+	/*
+	 * For the benchmarks. Opens the file without connecting to the sound server, so nothing plays
+	 * it until fillBuffer is called, which does all the work of the audio callback. Only one thread
+	 * may call fillBuffer, and the file must be closed from that thread.
+	 */
+	void openWithoutOutput(const char *fname, const Options &opt);
+	USERET HOT size_t fillBuffer(void *data, size_t bytes); // returns how many bytes it filled
+	USERET INLINE size_t getMaxRequestBytes() const { return (size_t) BUFFER_FRAMES * FRAME_BYTES; }
 	USERET INLINE bool isFileOpen() const { return(reader != NULL); }
 	void getFilename(char **dest) const;
 
 	/*
-	 * I could modify AudioFileReader to allow for latency, historySize, and preloadSize
-	 * to be changed without restarting the dictation, but this function is only called
+	 * I could modify AudioFileReader to allow for latency, historySize, preloadSize, cacheSize, compactHistory, archiveSize, channelMode,
+	 * and followRecordings to be changed without restarting the dictation, but this function is only called
 	 * when the user closes the options window, so I'll take the easy route and just close
 	 * and re-open the file
 	 */
@@ -90,7 +126,7 @@ class Dictation {
 		char prevName[fnl];
 		std::memcpy(prevName, fileName, fnl);
 
-		unsigned bookmark = position;
+		uint64_t bookmark = position;
 		bool wasPaused = paused;
 
 		readLock.unlock();
@@ -101,11 +137,12 @@ class Dictation {
 		writeLock.lock();
 		readLock.lock();
 
-		position = bookmark;
+		seekTo.store(bookmark, std::memory_order_release);
 		paused = wasPaused;
 
 		readLock.unlock();
 		writeLock.unlock();
+		pauseWait.notify_all();
 
 	}
 
@@ -116,6 +153,18 @@ class Dictation {
 	void skipForward(int ms);
 	INLINE void skipBack(int ms) { skipForward(-ms); }
 
+	/*
+	 * Sets the skips (in milliseconds) the user can make with a single button or pedal press, and
+	 * whether they can jump back to the start. The audio at each of them is kept decoded.
+	 */
+	void setHotJumps(const std::vector<int> &milliseconds, bool restart);
+
+	// How many skips found their audio ready, and how many had to wait for it
+	void getJumpStatistics(unsigned &hits, unsigned &misses) const;
+
+	// How much memory the compressed history uses, and how many minutes of audio it holds
+	void getArchiveUsage(size_t &bytes, double &minutes) const;
+
 	INLINE void play() {
 		writeLock.lock();
 		readLock.lock();
@@ -180,7 +229,9 @@ class Dictation {
 	INLINE void toggleRewind() {
 		writeLock.lock();
 		readLock.lock();
-		mode = (mode == REWIND) ? NORMAL : REWIND;
+		if (mode == REWIND) mode = NORMAL; else {
+			mode = REWIND;
+		}
 		readLock.unlock();
 		writeLock.unlock();
 		pauseWait.notify_all();
@@ -205,7 +256,9 @@ class Dictation {
 	INLINE void toggleFastForward() {
 		writeLock.lock();
 		readLock.lock();
-		mode = (mode == FAST_FORWARD) ? NORMAL : FAST_FORWARD;
+		if (mode == FAST_FORWARD) mode = NORMAL; else {
+			mode = FAST_FORWARD;
+		}
 		readLock.unlock();
 		writeLock.unlock();
 		pauseWait.notify_all();
@@ -231,19 +284,27 @@ class Dictation {
 	USERET INLINE unsigned getPositionMilliseconds() const {
 		std::unique_lock<std::mutex> rLock(readLock);
 		if (reader == NULL) return 0;
-		return ((unsigned) ((double) 1000 * ((double) position / (double) (reader->getFileInfo().sampleRate * reader->getFileInfo().numChannels))));
+		return ((unsigned) ((double) 1000 * ((double) position / (double) reader->getFileInfo().sampleRate)));
 	}
 
 	USERET INLINE unsigned getLengthMilliseconds() const {
 		std::unique_lock<std::mutex> rLock(readLock);
 		if (reader == NULL) return 0;
-		return((unsigned)(1000.0 * ((double)reader->getFileInfo().numSamples / (double)(reader->getFileInfo().sampleRate * reader->getFileInfo().numChannels))));
+		return((unsigned)(1000.0 * ((double)reader->getNumFrames() / (double)reader->getFileInfo().sampleRate)));
 	}
 
 	USERET INLINE double getPositionPercentage() const {
 		std::unique_lock<std::mutex> rLock(readLock);
 		if (reader == NULL) return 0;
-		return (((double) position) / (double) reader->getFileInfo().numSamples);
+		const uint64_t length = reader->getNumFrames();
+		if (length == 0) return 0;
+		return (((double) position) / (double) length);
+	}
+
+	// True once a recording that was being followed is finished, and should be reopened to be played like any other file
+	USERET INLINE bool isRecordingFinished() const {
+		std::unique_lock<std::mutex> rLock(readLock);
+		return (reader != NULL && reader->isRecordingFinished());
 	}
 
 
@@ -757,6 +757,23 @@ void FootPedalCoordinator::syncDevices() {
 	syncLock.unlock();
 }
 
+std::vector<int> FootPedalCoordinator::getSkipDistances() {
+	std::vector<int> distances;
+	syncLock.lock();
+	for (const FootPedalConfiguration *conf : configs) {
+		for (unsigned short i = 0; i < conf->info.getNumButtons(); i++) {
+			if (conf->primaryButtonActions[i].type == Action::SKIP) distances.push_back(conf->primaryButtonActions[i].deciseconds);
+			if (conf->secondaryButtonActions[i].type == Action::SKIP) distances.push_back(conf->secondaryButtonActions[i].deciseconds);
+		}
+		for (unsigned short i = 0; i < conf->info.getNumAxes(); i++) {
+			if (conf->primaryAxisActions[i].type == Action::SKIP) distances.push_back(conf->primaryAxisActions[i].deciseconds);
+			if (conf->secondaryAxisActions[i].type == Action::SKIP) distances.push_back(conf->secondaryAxisActions[i].deciseconds);
+		}
+	}
+	syncLock.unlock();
+	return distances;
+}
+
 INLINE void FPC_WRITE(const void *buffer, size_t size, size_t count, FILE *stream) {
 	if (std::fwrite(buffer, size, count, stream) < count) {
 		std::fclose(stream);
@@ -225,6 +225,9 @@ class FootPedalCoordinator {
 	void dictationMode(const std::vector<FootPedalConfiguration*> &newConfigs);
 	void configurationMode();
 	void syncDevices();
+
+	// Returns the distance (in deciseconds) of every SKIP action in the current configuration
+	std::vector<int> getSkipDistances();
 };
 
 void saveFootpedalConfiguration(const std::vector<FootPedalConfiguration*> &configs);
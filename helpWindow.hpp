@@ -203,7 +203,7 @@ class HelpWindow : public Gtk::Window {
 		usage->insert(usage->end(), "OpenScribe is a program designed for transcribing audio files using a USB footpedal or hand control. For information on configuring your footpedal (or other input device), click on the Footpedal Configuration section in the Help explorer on the left.\n"
 		"\nWhile OpenScribe is intended to be used with a footpedal, you may also control audio playback with the mouse by clicking on the larger buttons on the main window. One of the key features of OpenScribe is the ability to slow down audio without lowering its pitch- a feature designed to help you decipher unclear words in the dictation. You can adjust the speed at which audio is played by clicking on the ");
 		usage->insert_pixbuf(usage->end(), Gdk::Pixbuf::create_from_file(INSTALL_DIR "/OpenScribe/icons/tortoise.svg"));
-		usage->insert(usage->end(), " button to reveal the slow speed slider, then adjusting the speed. Note that this slider adjusts the speed at which audio is played when it is slowed, but to actually play the audio at this slowed speed, you must either click the SLOW button, or slow the dictation using your footpedal. OpenScribe uses the open-source Sonic library, developed by Bill Cox, for slowing audio.\n"
+		usage->insert(usage->end(), " button to reveal the slow speed slider, then adjusting the speed. Note that this slider adjusts the speed at which audio is played when it is slowed, but to actually play the audio at this slowed speed, you must either click the SLOW button, or slow the dictation using your footpedal. By default, OpenScribe slows audio with its own WSOLA engine, which keeps voices clear at low speeds. The open-source Sonic library, developed by Bill Cox, can be chosen instead in the options window.\n"
 		"\nWhen OpenScribe starts, it requests to be kept in front of other windows so that it remains visible while you type in your word processor. If you do not want this behaviour, your window manager should allow you to turn this off. In Compiz, this is accomplished by right clicking on the window titlebar and unchecking 'Always On Top.'\n"
 		"\nIf you encounter any bugs in this program, you may report them to the developer at < mtpharoah@gmail.com >.");
 
@@ -285,7 +285,8 @@ class HelpWindow : public Gtk::Window {
 			configuration->insert(configuration->end(), " button on the main OpenScribe window to show/hide this slider.)\n");
 		configuration->insert_with_tag(configuration->end(), "\nFast Forward / Rewind\n", bold);
 			configuration->insert(configuration->end(), "Fast forward or rewind the audio.\n"
-			"The speed at which the audio is fast forwarded or rewinded can be changed in the options window.\n");
+			"The speed at which the audio is fast forwarded or rewinded can be changed in the options window.\n"
+			"Short pieces of the audio are played as it goes by, and playback carries on from the last one you heard.\n");
 		configuration->insert_with_tag(configuration->end(), "\nSkip Forward / Skip Backwards\n", bold);
 			configuration->insert(configuration->end(), "Skip forward/backward the specified number of seconds.\n");
 		configuration->insert_with_tag(configuration->end(), "\nSkip to Beginning\n", bold);
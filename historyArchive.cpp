@@ -0,0 +1,223 @@
+#include "historyArchive.hpp"
+
+#include <cstring>
+
+#include "sampleKernels.hpp"
+
+static const unsigned NO_CHUNK = 0xffffffff;
+
+// Residuals are Rice coded in blocks of this many samples, each with its own parameter
+static const unsigned BLOCK_SIZE = 256;
+static const unsigned PARAMETER_BITS = 5;
+static const unsigned MAX_PARAMETER = 17;
+
+/*
+ * A zigzagged residual of 16-bit samples always fits in 18 bits. A quotient this long is written
+ * as a run of ones followed by the raw residual instead, which bounds the worst case at 42 bits.
+ */
+static const unsigned ESCAPE_LENGTH = 24;
+static const unsigned RAW_BITS = 18;
+static const size_t WORST_CASE_BITS_PER_SAMPLE = ESCAPE_LENGTH + RAW_BITS;
+
+struct BitWriter {
+	unsigned char *out;
+	uint64_t acc;
+	unsigned bits;
+
+	INLINE void put(uint32_t value, unsigned n) {
+		acc = (acc << n) | value;
+		bits += n;
+		while (bits >= 8) {
+			bits -= 8;
+			*out++ = (unsigned char) (acc >> bits);
+		}
+	}
+
+	INLINE void flush() {
+		if (bits > 0) *out++ = (unsigned char) (acc << (8 - bits));
+		bits = 0;
+	}
+};
+
+struct BitReader {
+	const unsigned char *in;
+	uint64_t acc;
+	unsigned bits;
+
+	INLINE uint32_t get(unsigned n) {
+		while (bits < n) {
+			acc = (acc << 8) | *in++;
+			bits += 8;
+		}
+		bits -= n;
+		return (uint32_t) (acc >> bits) & ((1u << n) - 1u);
+	}
+};
+
+INLINE static int32_t predict(const int16_t *samples, unsigned i, unsigned numChannels) {
+	if (i >= 2 * numChannels) return 2 * (int32_t) samples[i - numChannels] - (int32_t) samples[i - 2 * numChannels];
+	if (i >= numChannels) return (int32_t) samples[i - numChannels];
+	return 0;
+}
+
+HistoryArchive *HistoryArchive::create(unsigned chunkSize, unsigned numChannels, size_t maxBytes) {
+	if (chunkSize == 0 || numChannels == 0 || maxBytes == 0) return NULL;
+
+	HistoryArchive *archive = new HistoryArchive();
+	archive->chunkSize = chunkSize;
+	archive->numChannels = numChannels;
+	archive->maxBytes = maxBytes;
+	archive->bytesUsed = 0;
+	archive->samplesStored = 0;
+	archive->clock = 0;
+	archive->samples = new int16_t[chunkSize];
+	archive->packed = new unsigned char[(chunkSize * WORST_CASE_BITS_PER_SAMPLE + (chunkSize / BLOCK_SIZE + 1) * PARAMETER_BITS) / 8 + 8];
+	archive->unpackedChunk = NO_CHUNK;
+	return archive;
+}
+
+HistoryArchive::~HistoryArchive() {
+	for (auto &entry : entries) delete[] entry.second.data;
+	delete[] samples;
+	delete[] packed;
+}
+
+bool HistoryArchive::contains(unsigned chunk) {
+	std::lock_guard<std::mutex> guard(lock);
+	return entries.count(chunk) != 0;
+}
+
+void HistoryArchive::evictOldest() {
+	std::map<unsigned, Entry>::iterator oldest = entries.begin();
+	for (std::map<unsigned, Entry>::iterator i = entries.begin(); i != entries.end(); ++i) {
+		if (i->second.lastUsed < oldest->second.lastUsed) oldest = i;
+	}
+	if (oldest->first == unpackedChunk) unpackedChunk = NO_CHUNK;
+	bytesUsed -= oldest->second.bytes;
+	samplesStored -= oldest->second.count;
+	delete[] oldest->second.data;
+	entries.erase(oldest);
+}
+
+// Compresses the first count samples into packed, and returns how many bytes were used
+HOT unsigned HistoryArchive::pack(unsigned count) {
+	BitWriter writer = { packed, 0, 0 };
+	uint32_t residuals[BLOCK_SIZE];
+
+	for (unsigned block = 0; block < count; block += BLOCK_SIZE) {
+		const unsigned n = (count - block < BLOCK_SIZE) ? count - block : BLOCK_SIZE;
+		uint64_t sum = 0;
+		for (unsigned j = 0; j < n; j++) {
+			const int32_t residual = (int32_t) samples[block + j] - predict(samples, block + j, numChannels);
+			residuals[j] = ((uint32_t) residual << 1) ^ (uint32_t) (residual >> 31);
+			sum += residuals[j];
+		}
+
+		//the best parameter is close to log2 of the mean residual
+		unsigned k = 0;
+		while (k < MAX_PARAMETER && ((uint64_t) n << (k + 1)) <= sum) k++;
+		writer.put(k, PARAMETER_BITS);
+
+		for (unsigned j = 0; j < n; j++) {
+			const uint32_t quotient = residuals[j] >> k;
+			if (quotient >= ESCAPE_LENGTH) {
+				writer.put((1u << ESCAPE_LENGTH) - 1u, ESCAPE_LENGTH);
+				writer.put(residuals[j], RAW_BITS);
+			} else {
+				writer.put(((1u << quotient) - 1u) << 1, quotient + 1);
+				writer.put(residuals[j] & ((1u << k) - 1u), k);
+			}
+		}
+	}
+
+	writer.flush();
+	return (unsigned) (writer.out - packed);
+}
+
+// Decompresses an entry into samples
+HOT void HistoryArchive::unpack(const Entry &entry) {
+	BitReader reader = { entry.data, 0, 0 };
+
+	for (unsigned block = 0; block < entry.count; block += BLOCK_SIZE) {
+		const unsigned n = (entry.count - block < BLOCK_SIZE) ? entry.count - block : BLOCK_SIZE;
+		const unsigned k = reader.get(PARAMETER_BITS);
+
+		for (unsigned j = 0; j < n; j++) {
+			uint32_t quotient = 0;
+			while (quotient < ESCAPE_LENGTH && reader.get(1) != 0) quotient++;
+			const uint32_t zigzag = (quotient == ESCAPE_LENGTH) ? reader.get(RAW_BITS) : (quotient << k) | reader.get(k);
+			const int32_t residual = (int32_t) (zigzag >> 1) ^ -(int32_t) (zigzag & 1u);
+			samples[block + j] = (int16_t) (residual + predict(samples, block + j, numChannels));
+		}
+	}
+}
+
+void HistoryArchive::insert(unsigned chunk, const float *data, unsigned count) {
+	if (count > chunkSize) count = chunkSize;
+	if (count == 0) return;
+
+	std::lock_guard<std::mutex> guard(lock);
+	if (entries.count(chunk) != 0) return;
+
+	floatToInt16(samples, data, count);
+	const unsigned bytes = pack(count);
+	//samples now holds exactly what unpacking the new entry would give
+	unpackedChunk = chunk;
+	if (bytes > maxBytes) {
+		unpackedChunk = NO_CHUNK;
+		return;
+	}
+	while (bytesUsed + bytes > maxBytes) evictOldest();
+
+	Entry entry;
+	entry.data = new unsigned char[bytes];
+	std::memcpy((void*) entry.data, (const void*) packed, bytes);
+	entry.bytes = bytes;
+	entry.count = count;
+	entry.lastUsed = ++clock;
+	entries[chunk] = entry;
+	bytesUsed += bytes;
+	samplesStored += count;
+}
+
+bool HistoryArchive::copy(float *dest, uint64_t position, unsigned count) {
+	std::lock_guard<std::mutex> guard(lock);
+
+	//make sure every chunk is there before unpacking anything
+	const unsigned first = (unsigned) (position / chunkSize);
+	const unsigned last = (unsigned) ((position + count - 1) / chunkSize);
+	for (unsigned chunk = first; chunk <= last; chunk++) {
+		if (entries.count(chunk) == 0) return false;
+	}
+
+	clock++;
+	while (count > 0) {
+		const unsigned chunk = (unsigned) (position / chunkSize);
+		const unsigned offset = (unsigned) (position % chunkSize);
+		const unsigned n = (count < chunkSize - offset) ? count : chunkSize - offset;
+		Entry &entry = entries[chunk];
+
+		if (unpackedChunk != chunk) {
+			unpack(entry);
+			unpackedChunk = chunk;
+		}
+
+		//the last chunk of the file is short, and is followed by silence
+		const unsigned stored = (entry.count > offset) ? entry.count - offset : 0;
+		const unsigned available = (n < stored) ? n : stored;
+		int16ToFloat(dest, &samples[offset], available);
+		if (available < n) std::memset((void*) &dest[available], 0, (n - available) * sizeof(float));
+
+		entry.lastUsed = clock;
+		dest += n;
+		position += n;
+		count -= n;
+	}
+	return true;
+}
+
+void HistoryArchive::getUsage(size_t &bytes, size_t &numSamples) {
+	std::lock_guard<std::mutex> guard(lock);
+	bytes = bytesUsed;
+	numSamples = samplesStored;
+}
@@ -0,0 +1,66 @@
+#ifndef HISTORYARCHIVE_HPP_
+#define HISTORYARCHIVE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+#include "attributes.hpp"
+
+/*
+ * Second tier of the in-memory history, behind the segment cache. Chunks are rounded to 16-bit
+ * samples and then stored losslessly compressed: each channel is predicted from its previous two
+ * samples, and the residuals are Rice coded in blocks. This keeps several minutes of audio in the
+ * space the segment cache needs for one, and unpacking a chunk is much faster than seeking and
+ * decoding the original file again.
+ *
+ * When the archive is full, the chunk that was used longest ago is dropped.
+ */
+class HistoryArchive {
+  private:
+	struct Entry {
+		unsigned char *data;
+		unsigned bytes;
+		unsigned count;
+		uint64_t lastUsed;
+	};
+
+	unsigned chunkSize;
+	unsigned numChannels;
+	size_t maxBytes;
+	size_t bytesUsed;
+	size_t samplesStored;
+	uint64_t clock;
+	std::map<unsigned, Entry> entries;
+	std::mutex lock;
+
+	// Working space for packing and unpacking one chunk. Only used with the lock held.
+	int16_t *samples;
+	unsigned char *packed;
+	unsigned unpackedChunk;
+
+	HistoryArchive() {}
+	void evictOldest();
+	USERET unsigned pack(unsigned count);
+	void unpack(const Entry &entry);
+
+  public:
+	// Returns NULL if maxBytes is 0
+	USERET static HistoryArchive *create(unsigned chunkSize, unsigned numChannels, size_t maxBytes);
+	~HistoryArchive();
+
+	USERET INLINE unsigned getChunkSize() const { return chunkSize; }
+	USERET bool contains(unsigned chunk);
+
+	// Compresses and stores count samples (at most one chunk) of the given chunk
+	void insert(unsigned chunk, const float *data, unsigned count);
+
+	// Copies count samples starting at position into dest if they are all archived. Returns false otherwise.
+	USERET bool copy(float *dest, uint64_t position, unsigned count);
+
+	// How much memory the archive uses, and how many samples it holds
+	void getUsage(size_t &bytes, size_t &numSamples);
+};
+
+#endif /* HISTORYARCHIVE_HPP_ */
@@ -3,6 +3,8 @@
 #include <gtkmm/window.h>
 
 #include <fstream>
+#include <iostream>
+#include <cstring>
 #include <vector>
 
 #include "windowList.hpp"
@@ -13,11 +15,48 @@
 #include "helpWindow.hpp"
 #include "config.hpp"
 #include "footPedal.hpp"
+#include "timeStretcher.hpp"
+#include "benchmarks.hpp"
 
 /* xxx remember to update changelog.hpp and version.hpp xxx */
 #include "changelog.hpp"
 
 int main(int argc, char *argv[]) {
+	if (argc > 1 && std::strcmp(argv[1], "--benchmark-stretchers") == 0) {
+		TimeStretcher::benchmark(std::cout);
+		return 0;
+	}
+	if (argc > 1 && std::strcmp(argv[1], "--benchmark-kernels") == 0) {
+		benchmarkKernels(std::cout);
+		return 0;
+	}
+
+	//benchmarks that play a file
+	static const struct {
+		const char *flag;
+		void (*run)(const char*, std::ostream&);
+	} FILE_BENCHMARKS[] = {
+		{ "--benchmark-seek-storm", benchmarkSeekStorm },
+		{ "--benchmark-seeks", benchmarkSeeks },
+		{ "--benchmark-decoder", benchmarkDecoder },
+		{ "--benchmark-slow-playback", benchmarkSlowPlayback }
+	};
+	for (const auto &benchmark : FILE_BENCHMARKS) {
+		if (argc > 1 && std::strcmp(argv[1], benchmark.flag) == 0) {
+			if (argc < 3) {
+				std::cerr << "Usage: " << argv[0] << " " << benchmark.flag << " FILE" << std::endl;
+				return 1;
+			}
+			try {
+				benchmark.run(argv[2], std::cout);
+			} catch (const std::exception &ex) {
+				std::cerr << ex.what() << std::endl;
+				return 1;
+			}
+			return 0;
+		}
+	}
+
 	Glib::RefPtr<Gtk::Application> program = Gtk::Application::create("gtk.OpenScribe", Gio::APPLICATION_HANDLES_OPEN);
 
 	Version lastUsed = getLastVersionUsed();
@@ -72,6 +111,7 @@ int main(int argc, char *argv[]) {
 		// Error loading footpedal configuration, but this is not a fatal error. (FPC still starts)
 		Gtk::MessageDialog(Glib::ustring("Error loading footpedal configuration. You will need to reconfigure your footpedal(s)."), false, Gtk::MESSAGE_ERROR).run();
 	}
+	((MainWindow*)WindowList::main)->refreshHotJumps();
 	WindowList::main->show();
 	if (lastUsed < Version(1,0,0)) {
 		//First time running OpenScribe
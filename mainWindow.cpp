@@ -13,6 +13,16 @@ bool MainWindow::updatePosition() {
 
 	if (!adjustingSlider) slider.set_value(player->getPositionPercentage());
 
+	//the length isn't always known when a file is opened, and recordings still being made keep growing
+	if (player->getLengthMilliseconds() / 1000u != shownLength) updateNameAndDurationLabels();
+
+	//a finished recording is reopened as an ordinary file, without checking whether it is still being recorded
+	if (player->isRecordingFinished()) {
+		Options finished = options;
+		finished.followRecordings = false;
+		player->setOptions(finished);
+	}
+
 	// update the play button if we reach the end of the file
 	if (playButton.get_image() == &pauseIcon && player->isPaused()) {
 		playButton.set_image(playIcon);
@@ -32,6 +42,7 @@ void MainWindow::updateNameAndDurationLabels() {
 		char time[9];
 		register const unsigned seconds = player->getLengthMilliseconds() / 1000u;
 		std::snprintf(time, 9, "%2u:%02u", seconds / 60u, seconds % 60u);
+		shownLength = seconds;
 
 		audioFileLabel.set_text(&fileName[start]);
 		lengthLabel.set_text(time);
@@ -39,6 +50,7 @@ void MainWindow::updateNameAndDurationLabels() {
 	} else {
 		audioFileLabel.set_text("No audio file loaded.");
 		lengthLabel.set_text(" 0:00");
+		shownLength = 0;
 	}
 }
 
@@ -176,6 +188,17 @@ void MainWindow::updateOptions(const Options &opt) {
 	slowSpeedSlider.set_value(opt.slowSpeed);
 	player->setSlowSpeed(opt.slowSpeed);
 	options = opt;
+	refreshHotJumps();
+}
+
+// Tells the player about every jump the buttons and footpedals can make, so it can keep them ready
+void MainWindow::refreshHotJumps() {
+	std::vector<int> jumps;
+	jumps.push_back(-5000);
+	jumps.push_back(-10000);
+	jumps.push_back(-(int)options.skipBackOnPlay);
+	for (int deciseconds : pedals->getSkipDistances()) jumps.push_back(100 * deciseconds);
+	player->setHotJumps(jumps, true);
 }
 
 void MainWindow::onPedalEvent(Action cmd) {
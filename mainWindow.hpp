@@ -77,6 +77,7 @@ class MainWindow : public Gtk::Window {
 
 	bool adjustingSlider;
 	bool wasPlaying;
+	unsigned shownLength; // in seconds
 
 	Gtk::Image playIcon, pauseIcon;
 	Gtk::Image restartIcon, skipBack5Icon, skipBack10Icon, slowIcon, rwdIcon, ffwdIcon;
@@ -104,7 +105,7 @@ class MainWindow : public Gtk::Window {
 	void onStreamError() const;
 
   public:
-	MainWindow(Dictation *dict, const Options &opt, FootPedalCoordinator *fpc) : Gtk::Window(), player(dict), pedals(fpc), adjustingSlider(false), options(opt) {
+	MainWindow(Dictation *dict, const Options &opt, FootPedalCoordinator *fpc) : Gtk::Window(), player(dict), pedals(fpc), adjustingSlider(false), shownLength(0), options(opt) {
 		set_title("OpenScribe");
 		set_border_width(3);
 		set_resizable(false);
@@ -242,7 +243,9 @@ class MainWindow : public Gtk::Window {
 	virtual ~MainWindow() { timer.disconnect();	}
 
 	void updateOptions(const Options &opt);
+	void refreshHotJumps();
 	INLINE const Options &getOptions() const { return options; }
+	INLINE const Dictation &getPlayer() const { return *player; }
 
 	static void onPedalEventAdaptor(Action cmd) {
 		((MainWindow*)WindowList::main)->onPedalEvent(cmd);
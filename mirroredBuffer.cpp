@@ -0,0 +1,39 @@
+#include "mirroredBuffer.hpp"
+
+#include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
+
+MirroredBuffer::MirroredBuffer(size_t minBytes) {
+	bytes = (size_t) sysconf(_SC_PAGESIZE);
+	while (bytes < minBytes) bytes <<= 1;
+
+	int fd = memfd_create("OpenScribe ring buffer", MFD_CLOEXEC);
+	if (fd < 0) throw std::runtime_error("Error: Could not allocate memory for the audio buffer.");
+	if (ftruncate(fd, (off_t) bytes) != 0) {
+		close(fd);
+		throw std::runtime_error("Error: Could not allocate memory for the audio buffer.");
+	}
+
+	//reserve enough address space for both copies, then map the same memory into each half
+	char *reserved = (char*) mmap(NULL, 2 * bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (reserved == MAP_FAILED) {
+		close(fd);
+		throw std::runtime_error("Error: Could not allocate memory for the audio buffer.");
+	}
+
+	if (mmap(reserved, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+		mmap(reserved + bytes, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		munmap(reserved, 2 * bytes);
+		close(fd);
+		throw std::runtime_error("Error: Could not allocate memory for the audio buffer.");
+	}
+
+	//the mappings keep the memory alive, so we don't need the file descriptor anymore
+	close(fd);
+	base = (void*) reserved;
+}
+
+MirroredBuffer::~MirroredBuffer() {
+	munmap(base, 2 * bytes);
+}
@@ -0,0 +1,30 @@
+#ifndef MIRROREDBUFFER_HPP_
+#define MIRROREDBUFFER_HPP_
+
+#include <cstddef>
+
+#include "attributes.hpp"
+
+/*
+ * A block of memory that is mapped twice, back to back, in virtual memory.
+ * Writing to data()[i] also writes to data()[i + size()], so any span of up to
+ * size() bytes starting anywhere in the first mapping is contiguous, even if it
+ * wraps around the end of the buffer.
+ *
+ * The size is rounded up to a power of two (which is also a multiple of the page
+ * size), so ring buffer indices can be wrapped with a mask instead of a modulo.
+ */
+class MirroredBuffer {
+  private:
+	void *base;
+	size_t bytes;
+
+  public:
+	MirroredBuffer(size_t minBytes);
+	~MirroredBuffer();
+
+	USERET INLINE void *data() const { return base; }
+	USERET INLINE size_t size() const { return bytes; }
+};
+
+#endif /* MIRROREDBUFFER_HPP_ */
@@ -4,6 +4,7 @@
 
 #include <cmath>
 #include <ios>
+#include <iomanip>
 
 #include "windowList.hpp"
 #include "mainWindow.hpp"
@@ -15,9 +16,16 @@ void OptionsWindow::applyOptions() const {
 	options.rewindSpeed = (unsigned short)(1 << (int)rwdSlider.get_value());
 	options.fastForwardSpeed = (unsigned short)(1 << (int)ffwdSlider.get_value());
 	options.slowSpeed = (float)slowSlider.get_value();
+	options.stretchEngine = (StretchEngine)engineSelector.get_active_row_number();
+	options.stretchQuality = (StretchQuality)qualitySelector.get_active_row_number();
+	options.channelMode = (ChannelMode)channelSelector.get_active_row_number();
+	options.followRecordings = followCheckbox.get_active();
 	options.latency = (unsigned)latencySlider.get_value();
 	options.historySize = (unsigned)historySlider.get_value();
 	options.preloadSize = (unsigned)preloadSlider.get_value();
+	options.cacheSize = (unsigned)cacheSlider.get_value();
+	options.compactHistory = compactCheckbox.get_active();
+	options.archiveSize = (unsigned)archiveSlider.get_value();
 
 	((MainWindow*)WindowList::main)->updateOptions(options);
 
@@ -37,8 +45,27 @@ void OptionsWindow::on_show() {
 	rwdSlider.set_value(std::log2((double)options.rewindSpeed));
 	ffwdSlider.set_value(std::log2((double)options.fastForwardSpeed));
 	slowSlider.set_value(options.slowSpeed);
+	engineSelector.set_active((int)options.stretchEngine);
+	qualitySelector.set_active((int)options.stretchQuality);
+	channelSelector.set_active((int)options.channelMode);
+	followCheckbox.set_active(options.followRecordings);
 	latencySlider.set_value((double)options.latency);
+	compactCheckbox.set_active(options.compactHistory);
+	onCompactCheckClicked();
 	historySlider.set_value((double)options.historySize);
 	preloadSlider.set_value((double)options.preloadSize);
+	cacheSlider.set_value((double)options.cacheSize);
+	archiveSlider.set_value((double)options.archiveSize);
+
+	const Dictation &player = ((MainWindow*)WindowList::main)->getPlayer();
+	size_t archiveBytes;
+	double archiveMinutes;
+	player.getArchiveUsage(archiveBytes, archiveMinutes);
+	archiveUsageLabel.set_markup(Glib::ustring::compose("<i>In use: %1 MB, holding %2 minutes of audio</i>",
+		Glib::ustring::format(std::fixed, std::setprecision(1), (double)archiveBytes / 1048576.0), Glib::ustring::format(std::fixed, std::setprecision(1), archiveMinutes)));
+
+	unsigned hits, misses;
+	player.getJumpStatistics(hits, misses);
+	jumpStatsLabel.set_markup(Glib::ustring::compose("<i>Skips in this file that played without waiting: %1 of %2</i>", hits, hits + misses));
 	Gtk::Window::on_show();
 }
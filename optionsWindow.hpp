@@ -6,6 +6,7 @@
 #include <gtkmm/hvscale.h>
 #include <gtkmm/button.h>
 #include <gtkmm/checkbutton.h>
+#include <gtkmm/comboboxtext.h>
 #include <gtkmm/spinbutton.h>
 #include <gtkmm/hvseparator.h>
 #include <gtkmm/frame.h>
@@ -26,21 +27,23 @@ class OptionsWindow : public Gtk::Window {
 	Gtk::Grid buttonSublayout;
 
 	Gtk::HBox spacer1, spacer2, spacer3, spacer4, spacer5;
-	Gtk::HSeparator sep1, sep2, sep3, sep4;
+	Gtk::HSeparator sep1, sep2, sep3, sep4, sep5, sep6;
 	Gtk::HBox indent;
 
-	Gtk::Frame SBOPFrame, FFARFrame, SSFrame, AOFrame;
+	Gtk::Frame SBOPFrame, FFARFrame, SSFrame, CHFrame, LRFrame, AOFrame;
 
 	Gtk::SpinButton skipBackSpinner;
-	Gtk::CheckButton soundEffectsCheckbox, skipBackCheckbox;
+	Gtk::CheckButton soundEffectsCheckbox, skipBackCheckbox, compactCheckbox, followCheckbox;
 	Gtk::HScale rwdSlider, ffwdSlider, slowSlider;
-	Gtk::HScale latencySlider, preloadSlider, historySlider;
+	Gtk::ComboBoxText channelSelector, engineSelector, qualitySelector;
+	Gtk::HScale latencySlider, preloadSlider, historySlider, cacheSlider, archiveSlider;
 	Gtk::Button cancel, apply, okay;
 
 	Gtk::Label seconds;
-	Gtk::Label rwdLabel, ffwdLabel, slowLabel;
+	Gtk::Label rwdLabel, ffwdLabel, slowLabel, engineLabel;
 	Gtk::Label advOptLabel, advOptInfoLabel;
-	Gtk::Label latencyLabel, preloadLabel, historyLabel;
+	Gtk::Label latencyLabel, preloadLabel, historyLabel, cacheLabel, archiveLabel;
+	Gtk::Label archiveUsageLabel, jumpStatsLabel;
 
 	void applyOptions() const;
 	void applyAndClose() { applyOptions(); hide(); }
@@ -48,6 +51,10 @@ class OptionsWindow : public Gtk::Window {
 	Glib::ustring formatTimes(double value) const {			return Glib::ustring::compose("x%1", 1 << (int)value); }
 	Glib::ustring formatMilliseconds(double value) const {	return Glib::ustring::compose("%1 milliseconds", (int)value); }
 	Glib::ustring formatPercent(double value) const {		return Glib::ustring::compose("%1%%", (int)(100.0*value)); }
+	Glib::ustring formatMegabytes(double value) const {
+		if (value == 0.0) return Glib::ustring("Disabled");
+		return Glib::ustring::compose("%1 MB", (int)value);
+	}
 	Glib::ustring formatSeconds(double value) const {
 		if (value == 1.0) return Glib::ustring("1 second");
 		return Glib::ustring::compose("%1 seconds", (int)value);
@@ -56,6 +63,12 @@ class OptionsWindow : public Gtk::Window {
 	void onSkipCheckClicked() {
 		skipBackSpinner.set_sensitive(skipBackCheckbox.get_active());
 	}
+	void onCompactCheckClicked() {
+		const unsigned maxHistory = compactCheckbox.get_active() ? MAX_COMPACT_HISTORY_SECONDS : MAX_HISTORY_SECONDS;
+		historySlider.set_range(1.0, (double)maxHistory);
+		historySlider.clear_marks();
+		for (unsigned i = 1; i <= maxHistory; i++) historySlider.add_mark((double)i, Gtk::POS_TOP, Glib::ustring());
+	}
 
   protected:
 	virtual void on_show();
@@ -68,24 +81,43 @@ class OptionsWindow : public Gtk::Window {
 
 		skipBackCheckbox.set_label("Skip back when resuming playback");
 		seconds.set_label("seconds");
-		soundEffectsCheckbox.set_label("Rewind and fast forward sound effects");
+		soundEffectsCheckbox.set_label("Hear the audio while rewinding and fast forwarding");
 		rwdLabel.set_markup("<b>Rewind Speed</b>");
 		ffwdLabel.set_markup("<b>Fast Forward Speed</b>");
 		slowLabel.set_markup("<b>Default Slow Speed</b>");
+		engineLabel.set_markup("<b>Slow Down Method</b>");
 		advOptLabel.set_markup("<b><big>Advanced Options</big></b>");
 		advOptInfoLabel.set_markup("<i>You do not need to adjust these settings unless you experience audio stuttering, audio latency, or delayed foot pedal response. Mouse over each slider for information.</i>");
 		latencyLabel.set_markup("<b>Target Audio Latency</b>");
 		historyLabel.set_markup("<b>Audio History Size</b>");
 		preloadLabel.set_markup("<b>Audio Preload Size</b>");
+		cacheLabel.set_markup("<b>Decoded Audio Cache Size</b>");
+		archiveLabel.set_markup("<b>Compressed Audio History Size</b>");
+		compactCheckbox.set_label("Store audio history at 16-bit precision");
+		followCheckbox.set_label("Keep playing recordings that are still being made");
 		cancel.set_label("Cancel");
 		apply.set_label("Apply");
 		okay.set_label("Okay");
 		SBOPFrame.set_label("Skip on Playback");
 		FFARFrame.set_label("Fast Forward and Rewind");
 		SSFrame.set_label("Slow Speed");
+		CHFrame.set_label("Channels");
+		LRFrame.set_label("Live Recordings");
+		channelSelector.append("Play all channels");
+		channelSelector.append("Mix all channels into one");
+		channelSelector.append("Play the left channel only");
+		channelSelector.append("Play the right channel only");
+		engineSelector.append("WSOLA (clearer at low speeds)");
+		engineSelector.append("Sonic (uses the least processing time)");
+		qualitySelector.append("Fast");
+		qualitySelector.append("Balanced");
+		qualitySelector.append("Best");
 
 		advOptInfoLabel.set_line_wrap(true);
 		advOptInfoLabel.set_single_line_mode(false);
+		archiveUsageLabel.set_margin_bottom(4);
+		jumpStatsLabel.set_line_wrap(true);
+		jumpStatsLabel.set_margin_top(4);
 		buttonSublayout.set_column_homogeneous(true);
 		rwdSlider.set_range(0.0, 6.0);
 		rwdSlider.set_draw_value(true);
@@ -105,16 +137,27 @@ class OptionsWindow : public Gtk::Window {
 		latencySlider.set_draw_value(true);
 		latencySlider.set_value_pos(Gtk::POS_TOP);
 		latencySlider.set_round_digits(0);
-		historySlider.set_range(1.0, 13.0);
 		historySlider.set_draw_value(true);
 		historySlider.set_value_pos(Gtk::POS_TOP);
 		historySlider.set_round_digits(0);
-		for (int i = 1; i <= 13; i++) historySlider.add_mark((double)i, Gtk::POS_TOP, Glib::ustring());
+		onCompactCheckClicked();
 		preloadSlider.set_range(1.0, 13.0);
 		preloadSlider.set_draw_value(true);
 		preloadSlider.set_value_pos(Gtk::POS_TOP);
 		preloadSlider.set_round_digits(0);
 		for (int i = 1; i <= 13; i++) preloadSlider.add_mark((double)i, Gtk::POS_TOP, Glib::ustring());
+		cacheSlider.set_range(0.0, 8192.0);
+		cacheSlider.set_increments(256.0, 1024.0);
+		cacheSlider.set_draw_value(true);
+		cacheSlider.set_value_pos(Gtk::POS_TOP);
+		cacheSlider.set_round_digits(0);
+		for (int i = 0; i <= 8; i++) cacheSlider.add_mark(1024.0 * (double)i, Gtk::POS_TOP, Glib::ustring());
+		archiveSlider.set_range(0.0, (double)MAX_ARCHIVE_MEGABYTES);
+		archiveSlider.set_increments(16.0, 64.0);
+		archiveSlider.set_draw_value(true);
+		archiveSlider.set_value_pos(Gtk::POS_TOP);
+		archiveSlider.set_round_digits(0);
+		for (int i = 0; i <= MAX_ARCHIVE_MEGABYTES / 64; i++) archiveSlider.add_mark(64.0 * (double)i, Gtk::POS_TOP, Glib::ustring());
 		skipBackSpinner.set_range(0.0, 10.0);
 		skipBackSpinner.set_digits(2);
 		skipBackSpinner.set_numeric(true);
@@ -131,11 +174,23 @@ class OptionsWindow : public Gtk::Window {
 		sep3.set_margin_bottom(8);
 		sep4.set_margin_top(8);
 		sep4.set_margin_bottom(8);
+		sep5.set_margin_top(8);
+		sep5.set_margin_bottom(8);
+		sep6.set_margin_top(8);
+		sep6.set_margin_bottom(8);
 		indent.set_size_request(32, 1);
 
+		channelSelector.set_tooltip_text("Interviews and telephone recordings often have one speaker on each channel, or the same audio on both. Playing them as mono halves the memory and processing time OpenScribe needs for them. Has no effect on mono files. Default is to play all channels.");
+		engineSelector.set_tooltip_text("How audio is slowed down without changing its pitch. WSOLA keeps voices clearer at low speeds, especially below 50%. Sonic takes less processing time, but can sound rough when slowed a lot. Default is WSOLA.");
+		qualitySelector.set_tooltip_text("How carefully each piece of slowed audio is lined up with the last. Higher settings sound smoother on deep voices and use more processing time. Every setting is still many times faster than real time on a typical computer. Default is Balanced.");
+		followCheckbox.set_tooltip_text("When you open a file that is still being written to, OpenScribe assumes it is being recorded and watches it for new audio, so you can start typing while the speaker is still talking. The length of the file grows as the recording does, until the recording stops. Checking takes up to a second each time a recently changed file is opened, so this is off by default.");
 		latencySlider.set_tooltip_text("The desired audio latency in milliseconds. A lower value means better responsiveness, but setting it too low may cause stuttering on slow computers. Default value is 25ms.");
-		historySlider.set_tooltip_text("Sets the maximum length of audio that is kept in memory after it has played. Skipping back further than this means that the audio will need to be decoded from the file again, which causes a slight pause. It is highly recommended to set this to at least 3 to 5 seconds. For a typical audio file, each second of history saved increases memory usage by about 1/3rd of a megabyte (exact value depends on sample rate and number of channels). Default value is 6 seconds.");
+		historySlider.set_tooltip_text("Sets the maximum length of audio that is kept in memory after it has played. Skipping back further than this means that the audio will need to be decoded from the file again, which causes a slight pause. It is highly recommended to set this to at least 3 to 5 seconds. It can be up to 13 seconds long, or 26 when storing audio history at 16-bit precision. For a typical audio file, each second of history saved increases memory usage by about 1/3rd of a megabyte, or half that when storing audio history at 16-bit precision (exact value depends on sample rate and number of channels). Default value is 6 seconds.");
 		preloadSlider.set_tooltip_text("Since decoding audio from a file takes time, OpenScribe decodes audio from the file ahead of the current position so that the data will be decoded and ready to play by the time the audio is needed. This slider sets how far ahead of the current position OpenScribe should go when preparing audio for playback. The actual amount of audio in memory that is ahead of the current position can be larger than this value if the user skips back (since the audio history we skipped past is now in the future). There is little benefit to making this a large value unless you are running another process in the background with irregular CPU usage. Default value is 2 seconds.");
+		cacheSlider.set_tooltip_text("OpenScribe saves decoded audio to ~/.cache/OpenScribe the first time you play a file. Playing the file again reads the saved audio directly, so opening and skipping around in it is instant. This slider sets the maximum amount of disk space the cache may use. When it is full, the files you have not used for the longest time are removed first. Each minute of audio takes between 2 MB (8 kHz mono) and 23 MB (48 kHz stereo). Default value is 2048 MB.");
+		archiveSlider.set_tooltip_text("Besides the audio history above, OpenScribe keeps audio you have recently played compressed in memory, so skipping back a minute or two is nearly instant instead of decoding the file again. This slider sets how much memory the compressed history may use. Each minute of audio takes roughly 0.6 MB (8 kHz mono) to 7 MB (48 kHz stereo), depending on how noisy the recording is. Default value is 32 MB.");
+		jumpStatsLabel.set_tooltip_text("How many of the skips made in the open file played straight away, because the audio was already decoded. If many of them had to wait, try a larger audio history or preload size.");
+		compactCheckbox.set_tooltip_text("Keeps the audio history and preloaded audio in memory as 16-bit samples instead of 32-bit floating point, which halves the memory they use so that a longer history can be kept. Most recordings are 16-bit to begin with, so this rarely makes an audible difference. Disabled by default.");
 
 		add(rootLayout);
 			rootLayout.pack_start(SBOPFrame, false, false);
@@ -161,6 +216,13 @@ class OptionsWindow : public Gtk::Window {
 				SSFrame.add(SSLayout);
 					SSLayout.pack_start(slowLabel);
 					SSLayout.pack_start(slowSlider);
+					SSLayout.pack_start(engineLabel);
+					SSLayout.pack_start(engineSelector);
+					SSLayout.pack_start(qualitySelector);
+			rootLayout.pack_start(CHFrame, false, false);
+				CHFrame.add(channelSelector);
+			rootLayout.pack_start(LRFrame, false, false);
+				LRFrame.add(followCheckbox);
 			rootLayout.pack_start(AOFrame, false, false);
 				AOFrame.add(AOLayout);
 					AOLayout.pack_start(advOptLabel);
@@ -174,6 +236,15 @@ class OptionsWindow : public Gtk::Window {
 					AOLayout.pack_start(sep4);
 					AOLayout.pack_start(preloadLabel);
 					AOLayout.pack_start(preloadSlider);
+					AOLayout.pack_start(sep5);
+					AOLayout.pack_start(cacheLabel);
+					AOLayout.pack_start(cacheSlider);
+					AOLayout.pack_start(sep6);
+					AOLayout.pack_start(archiveLabel);
+					AOLayout.pack_start(archiveSlider);
+					AOLayout.pack_start(archiveUsageLabel);
+					AOLayout.pack_start(compactCheckbox);
+					AOLayout.pack_start(jumpStatsLabel);
 			rootLayout.pack_start(spacer4, true, true);
 			rootLayout.pack_start(buttonLayout, false, false);
 				buttonLayout.pack_start(spacer5, true, true);
@@ -186,6 +257,7 @@ class OptionsWindow : public Gtk::Window {
 		show_all_children();
 
 		skipBackCheckbox.signal_clicked().connect(sigc::mem_fun(*this, &OptionsWindow::onSkipCheckClicked));
+		compactCheckbox.signal_clicked().connect(sigc::mem_fun(*this, &OptionsWindow::onCompactCheckClicked));
 		cancel.signal_clicked().connect(sigc::mem_fun(*this, &OptionsWindow::hide));
 		apply.signal_clicked().connect(sigc::mem_fun(*this, &OptionsWindow::applyOptions));
 		okay.signal_clicked().connect(sigc::mem_fun(*this, &OptionsWindow::applyAndClose));
@@ -196,6 +268,8 @@ class OptionsWindow : public Gtk::Window {
 		latencySlider.signal_format_value().connect(sigc::mem_fun(*this, &OptionsWindow::formatMilliseconds));
 		preloadSlider.signal_format_value().connect(sigc::mem_fun(*this, &OptionsWindow::formatSeconds));
 		historySlider.signal_format_value().connect(sigc::mem_fun(*this, &OptionsWindow::formatSeconds));
+		cacheSlider.signal_format_value().connect(sigc::mem_fun(*this, &OptionsWindow::formatMegabytes));
+		archiveSlider.signal_format_value().connect(sigc::mem_fun(*this, &OptionsWindow::formatMegabytes));
 	}
 	INLINE ~OptionsWindow() {}
 };
@@ -0,0 +1,303 @@
+#include "pcmCache.hpp"
+
+#include <sox.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "config.hpp"
+#include "sampleKernels.hpp"
+
+static const char CACHE_MAGIC[8] = { 'O', 'S', 'P', 'C', 'M', '0', '1', '\0' };
+static const size_t FILL_CHUNK = 65536; // samples decoded per sox_read when filling the cache
+
+struct CacheEntry {
+	std::string path;
+	time_t lastUsed;
+	size_t bytes;
+};
+
+/*
+ * Deletes the least recently used cache files until the cache (plus the space we are about to
+ * use for a new file) fits under the size cap. Seek indexes live in the same folder and count
+ * towards the cap too, except for the one belonging to the file being cached. The access time of a cache file is not reliable
+ * on relatime/noatime mounts, so we bump the modification time whenever a file is opened instead.
+ */
+static void evictLeastRecentlyUsed(const std::string &folder, const std::string &keep, const std::string &keepIndex, size_t incomingBytes, size_t maxCacheBytes) {
+	DIR *dir = opendir(folder.c_str());
+	if (dir == NULL) return;
+
+	std::vector<CacheEntry> entries;
+	size_t total = incomingBytes;
+	for (dirent *ent = readdir(dir); ent != NULL; ent = readdir(dir)) {
+		const size_t len = std::strlen(ent->d_name);
+		if (len < 5 || (std::strcmp(&ent->d_name[len-4], ".pcm") != 0 && std::strcmp(&ent->d_name[len-4], ".idx") != 0)) continue;
+
+		CacheEntry entry;
+		entry.path = folder + "/" + ent->d_name;
+		if (entry.path == keep || entry.path == keepIndex) continue;
+
+		struct stat info;
+		if (stat(entry.path.c_str(), &info) != 0) continue;
+		entry.lastUsed = info.st_mtime;
+		entry.bytes = (size_t) info.st_blocks * 512;
+		total += entry.bytes;
+		entries.push_back(entry);
+	}
+	closedir(dir);
+
+	std::sort(entries.begin(), entries.end(), [](const CacheEntry &a, const CacheEntry &b) { return a.lastUsed < b.lastUsed; });
+	for (size_t i = 0; i < entries.size() && total > maxCacheBytes; i++) {
+		if (unlink(entries[i].path.c_str()) == 0) total -= entries[i].bytes;
+	}
+}
+
+PcmCache *PcmCache::open(const char *fname, unsigned sampleRate, unsigned outputRate, unsigned numChannels, size_t numSamples, size_t maxCacheBytes) {
+	if (maxCacheBytes == 0 || numSamples == 0) return NULL;
+
+	//Resampled audio goes in a file of its own for each rate, so switching sound servers doesn't throw the cache away
+	Resampler *resampler = (outputRate != 0) ? Resampler::create(sampleRate, outputRate, numChannels) : NULL;
+	char extension[16] = "pcm";
+	size_t cachedSamples = numSamples;
+	if (resampler != NULL) {
+		std::snprintf(extension, sizeof(extension), "%u.pcm", outputRate);
+		cachedSamples = resampler->outputFrames(numSamples / numChannels) * numChannels;
+	}
+
+	PcmCache *cache = map(fname, getCacheFilePath(fname, extension), (resampler != NULL) ? outputRate : sampleRate, numChannels, cachedSamples, maxCacheBytes);
+	if (cache == NULL) {
+		delete resampler;
+		return NULL;
+	}
+
+	cache->resampler = resampler;
+	cache->sourceSamples = numSamples;
+
+	//Only one process fills in a given cache file. If someone else has it, we just read what they've written.
+	cache->filling = !cache->isComplete() && flock(cache->fd, LOCK_EX | LOCK_NB) == 0;
+	if (cache->filling) cache->fillerThread = new std::thread(&PcmCache::fillerLoop, cache);
+
+	return cache;
+}
+
+PcmCache *PcmCache::map(const char *fname, const std::string &cachePath, unsigned sampleRate, unsigned numChannels, size_t numSamples, size_t maxCacheBytes) {
+	struct stat fileStat;
+	if (cachePath.empty() || stat(fname, &fileStat) != 0) return NULL;
+
+	const size_t headerBytes = (size_t) sysconf(_SC_PAGESIZE);
+	const size_t mappedBytes = headerBytes + numSamples * sizeof(float);
+	if (mappedBytes > maxCacheBytes) return NULL;
+
+	const std::string folder = cachePath.substr(0, cachePath.rfind('/'));
+	int fd = ::open(cachePath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0) return NULL;
+
+	struct stat cacheStat;
+	if (fstat(fd, &cacheStat) != 0) {
+		::close(fd);
+		return NULL;
+	}
+
+	const bool isNew = ((size_t) cacheStat.st_size != mappedBytes);
+	if (isNew) {
+		evictLeastRecentlyUsed(folder, cachePath, getCacheFilePath(fname, "idx"), mappedBytes, maxCacheBytes);
+		if (ftruncate(fd, 0) != 0) {
+			::close(fd);
+			unlink(cachePath.c_str());
+			return NULL;
+		}
+	}
+
+	/*
+	 * Writing to a hole in a shared mapping when the disk is full kills us with SIGBUS, so every
+	 * block is allocated up front. This is cheap for blocks that already are. If the disk is too full, there's no cache.
+	 */
+	if (posix_fallocate(fd, 0, (off_t) mappedBytes) != 0) {
+		::close(fd);
+		unlink(cachePath.c_str());
+		return NULL;
+	}
+
+	void *mapping = mmap(NULL, mappedBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (mapping == MAP_FAILED) {
+		::close(fd);
+		return NULL;
+	}
+
+	PcmCacheHeader *header = (PcmCacheHeader*) mapping;
+	const bool matches = !isNew && std::memcmp(header->magic, CACHE_MAGIC, 8) == 0 &&
+		header->fileSize == (uint64_t) fileStat.st_size && header->modifiedSeconds == (int64_t) fileStat.st_mtim.tv_sec &&
+		header->modifiedNanoseconds == (int64_t) fileStat.st_mtim.tv_nsec &&
+		header->sampleRate == sampleRate && header->numChannels == numChannels && header->numSamples == numSamples &&
+		header->filled <= numSamples;
+
+	if (!matches) {
+		// either a new file or a stale/corrupt one- start over
+		std::memset(mapping, 0, headerBytes);
+		std::memcpy(header->magic, CACHE_MAGIC, 8);
+		header->fileSize = (uint64_t) fileStat.st_size;
+		header->modifiedSeconds = (int64_t) fileStat.st_mtim.tv_sec;
+		header->modifiedNanoseconds = (int64_t) fileStat.st_mtim.tv_nsec;
+		header->sampleRate = sampleRate;
+		header->numChannels = numChannels;
+		header->numSamples = numSamples;
+		header->filled = 0;
+	}
+
+	//mark the file as recently used
+	futimens(fd, NULL);
+
+	PcmCache *cache = new PcmCache();
+	cache->fd = fd;
+	cache->header = header;
+	cache->samples = (float*) ((char*) mapping + headerBytes);
+	cache->mappedBytes = mappedBytes;
+	cache->alive = true;
+	cache->fillerThread = NULL;
+
+	const size_t chars = std::strlen(fname) + 1;
+	cache->audioFilename = new char[chars];
+	std::memcpy(cache->audioFilename, fname, chars);
+	cache->resampler = NULL;
+	cache->sourceSamples = numSamples;
+	cache->filling = false;
+
+	return cache;
+}
+
+PcmCache::~PcmCache() {
+	alive = false;
+	if (fillerThread != NULL) {
+		fillerThread->join();
+		delete fillerThread;
+	}
+
+	munmap((void*) header, mappedBytes);
+	::close(fd); // also releases the flock
+	delete[] audioFilename;
+	delete resampler;
+}
+
+void PcmCache::fillerLoop() {
+	//decoding the cache should never get in the way of the preloader, so run it at a lower priority
+	setpriority(PRIO_PROCESS, (id_t) syscall(SYS_gettid), 10);
+
+	sox_format_t *audioFile = sox_open_read(audioFilename, NULL, NULL, NULL);
+	if (audioFile == NULL) return;
+
+	//resampled output near where we left off depends on a little input before it
+	size_t filled = numCached();
+	size_t resumeAt = filled;
+	if (resampler != NULL) {
+		const int64_t frame = resampler->firstInput(filled / header->numChannels);
+		resumeAt = (frame > 0) ? (size_t) frame * header->numChannels : 0;
+	}
+	if (filled > 0 && sox_seek(audioFile, resumeAt, SOX_SEEK_SET) != SOX_SUCCESS) {
+		filled = 0;
+		__atomic_store_n(&header->filled, 0, __ATOMIC_RELEASE);
+		sox_close(audioFile);
+		audioFile = sox_open_read(audioFilename, NULL, NULL, NULL);
+		if (audioFile == NULL) return;
+	}
+
+	if (resampler != NULL) {
+		fillResampled(audioFile, filled);
+		sox_close(audioFile);
+		return;
+	}
+
+	int *toConvert = new int[FILL_CHUNK];
+	while (alive && filled < header->numSamples) {
+		size_t request = header->numSamples - filled;
+		if (request > FILL_CHUNK) request = FILL_CHUNK;
+
+		const size_t read = sox_read(audioFile, toConvert, request);
+		if (read == 0) break;
+
+		//SoX reads in signed 32-bit integer format, but I want floating point format. Convert it.
+		float *dest = &samples[filled];
+		for (size_t i = 0; i < read; i++) dest[i] = (float) ((double) toConvert[i] / (double) 0x80000000);
+
+		filled += read;
+		__atomic_store_n(&header->filled, (uint64_t) filled, __ATOMIC_RELEASE);
+	}
+	delete[] toConvert;
+
+	sox_close(audioFile);
+}
+
+/*
+ * Fills the cache with the file resampled to the cache's rate. audioFile must be positioned at the first input frame
+ * the output from filled onwards needs. The input is kept in a window that slides along with the output, like the decoder's.
+ */
+void PcmCache::fillResampled(sox_format_t *audioFile, size_t filled) {
+	const unsigned numChannels = header->numChannels;
+	const size_t sourceFrames = sourceSamples / numChannels;
+	const size_t numFrames = header->numSamples / numChannels;
+	const unsigned chunkFrames = (unsigned) (FILL_CHUNK / numChannels);
+	const size_t windowSamples = resampler->maxInputFrames(chunkFrames) * numChannels;
+	float *window = new float[windowSamples];
+	int *toConvert = new int[windowSamples];
+
+	size_t frame = filled / numChannels;
+	int64_t windowStart = resampler->firstInput(frame);
+	size_t windowFrames = 0;
+	bool ended = false;
+	while (alive && !ended && frame < numFrames) {
+		const unsigned count = (numFrames - frame < chunkFrames) ? (unsigned) (numFrames - frame) : chunkFrames;
+		const int64_t from = resampler->firstInput(frame);
+		const int64_t to = resampler->endInput(frame + count);
+
+		//drop the input the previous chunk needed and this one doesn't
+		const size_t drop = (size_t) (from - windowStart);
+		std::memmove((void*) window, (const void*) &window[drop * numChannels], (windowFrames - drop) * numChannels * sizeof(float));
+		windowFrames -= drop;
+		windowStart = from;
+
+		while (windowStart + (int64_t) windowFrames < to) {
+			const int64_t next = windowStart + (int64_t) windowFrames;
+			float *input = &window[windowFrames * numChannels];
+			size_t numInput = (size_t) (to - next);
+			if (next < 0 || (size_t) next >= sourceFrames) {
+				//the filter reaches past either end of the file
+				if (next < 0 && numInput > (size_t) -next) numInput = (size_t) -next;
+				std::memset((void*) input, 0, numInput * numChannels * sizeof(float));
+			} else {
+				if (numInput > sourceFrames - (size_t) next) numInput = sourceFrames - (size_t) next;
+				//SoX may stop partway through a frame
+				size_t read = 0;
+				while (read < numInput * numChannels) {
+					const size_t more = sox_read(audioFile, &toConvert[read], numInput * numChannels - read);
+					if (more == 0) break;
+					read += more;
+				}
+				numInput = read / numChannels;
+				if (numInput == 0) {
+					ended = true;
+					break;
+				}
+				int32ToFloat(input, toConvert, numInput * numChannels);
+			}
+			windowFrames += numInput;
+		}
+		if (ended) break;
+
+		resampler->process(&samples[frame * numChannels], frame, count, window, windowStart);
+		frame += count;
+		__atomic_store_n(&header->filled, (uint64_t) (frame * numChannels), __ATOMIC_RELEASE);
+	}
+	delete[] toConvert;
+	delete[] window;
+}
@@ -0,0 +1,83 @@
+#ifndef PCMCACHE_HPP_
+#define PCMCACHE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <atomic>
+#include <string>
+
+#include <sox.h>
+
+#include "attributes.hpp"
+#include "resampler.hpp"
+
+/*
+ * Layout of the first page of a cache file. The decoded samples start on the
+ * following page, so the whole file can be memory mapped and read directly.
+ */
+struct PcmCacheHeader {
+	char magic[8];
+	uint64_t fileSize;
+	int64_t modifiedSeconds;
+	int64_t modifiedNanoseconds;
+	uint32_t sampleRate;
+	uint32_t numChannels;
+	uint64_t numSamples;
+	uint64_t filled; // number of samples decoded so far. These are always a prefix of the file.
+};
+
+/*
+ * Persistent cache of decoded audio, stored under ~/.cache/OpenScribe
+ *
+ * Each audio file gets one cache file, keyed by its path, size, modification time, and a
+ * hash of its contents. The first time a file is opened, a background thread decodes it
+ * into the cache. Once a range of samples is cached, it can be read straight out of the
+ * mapping without touching the decoder, so seeks within it are free.
+ *
+ * If the audio is played at a different rate, the cache holds it already resampled to that rate,
+ * in a cache file of its own, so reading from the cache never needs the resampler.
+ *
+ * The total size of the cache is capped. When it grows too large, the least recently
+ * used files are deleted.
+ */
+class PcmCache {
+  private:
+	int fd;
+	PcmCacheHeader *header;
+	float *samples;
+	size_t mappedBytes;
+
+	char *audioFilename;
+	Resampler *resampler; // from the file's rate to the cache's, or NULL if they're the same
+	size_t sourceSamples; // in the file, at its own rate
+	bool filling;
+	std::atomic<bool> alive;
+	std::thread *fillerThread;
+
+	PcmCache() {}
+	// Maps the cache file, starting it over if it doesn't match the audio file
+	USERET static PcmCache *map(const char *fname, const std::string &cachePath, unsigned sampleRate, unsigned numChannels, size_t numSamples, size_t maxCacheBytes);
+	void fillerLoop();
+	void fillResampled(sox_format_t *audioFile, size_t filled);
+
+  public:
+	/*
+	 * Opens (or creates) the cache file for the given audio file, which has numSamples samples at
+	 * sampleRate. The cache holds them resampled to outputRate, unless it's 0.
+	 * Returns NULL if the file cannot be cached, in which case the caller should just decode as usual.
+	 */
+	USERET static PcmCache *open(const char *fname, unsigned sampleRate, unsigned outputRate, unsigned numChannels, size_t numSamples, size_t maxCacheBytes);
+	~PcmCache();
+
+	USERET INLINE size_t numCached() const { return (size_t) __atomic_load_n(&header->filled, __ATOMIC_ACQUIRE); }
+	USERET INLINE bool isComplete() const { return numCached() == header->numSamples; }
+
+	// Returns a pointer to the requested samples if they are all cached, or NULL otherwise
+	USERET INLINE const float *get(size_t position, size_t numSamples) const {
+		if (position + numSamples > numCached()) return NULL;
+		return &samples[position];
+	}
+};
+
+#endif /* PCMCACHE_HPP_ */
@@ -0,0 +1,251 @@
+#include "pcmFileMap.hpp"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+
+#include "sampleKernels.hpp"
+
+INLINE static uint16_t le16(const unsigned char *p) { return (uint16_t) (p[0] | (p[1] << 8)); }
+INLINE static uint32_t le32(const unsigned char *p) { return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24); }
+INLINE static uint16_t be16(const unsigned char *p) { return (uint16_t) ((p[0] << 8) | p[1]); }
+INLINE static uint32_t be32(const unsigned char *p) { return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | (uint32_t) p[3]; }
+
+// AIFF stores its sample rate as an 80-bit IEEE 754 extended precision float
+static double be80(const unsigned char *p) {
+	const int exponent = ((p[0] & 0x7f) << 8) | p[1];
+	uint64_t mantissa = 0;
+	for (int i = 0; i < 8; i++) mantissa = (mantissa << 8) | p[2+i];
+	if (exponent == 0 && mantissa == 0) return 0.0;
+	const double value = std::ldexp((double) mantissa, exponent - 16383 - 63);
+	return (p[0] & 0x80) ? -value : value;
+}
+
+PcmFileMap *PcmFileMap::open(const char *fname) {
+	int fd = ::open(fname, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return NULL;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size < 12) {
+		::close(fd);
+		return NULL;
+	}
+
+	void *mapping = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (mapping == MAP_FAILED) return NULL;
+
+	PcmFileMap *file = new PcmFileMap();
+	file->mapping = mapping;
+	file->mappedBytes = (size_t) info.st_size;
+
+	const size_t fileSize = (size_t) info.st_size;
+	const unsigned char *bytes = (const unsigned char*) mapping;
+	bool ok = false;
+	if (std::memcmp(bytes, "RIFF", 4) == 0 && std::memcmp(&bytes[8], "WAVE", 4) == 0) {
+		ok = file->parseWave(fileSize);
+	} else if (std::memcmp(bytes, "FORM", 4) == 0 && (std::memcmp(&bytes[8], "AIFF", 4) == 0 || std::memcmp(&bytes[8], "AIFC", 4) == 0)) {
+		ok = file->parseAiff(fileSize);
+	} else if (std::memcmp(bytes, ".snd", 4) == 0) {
+		ok = file->parseAu(fileSize);
+	}
+
+	if (!ok || file->sampleRate == 0 || file->numChannels == 0 || file->numSamples == 0) {
+		delete file;
+		return NULL;
+	}
+
+	//skipping back reads the pages behind the playhead, so they shouldn't be dropped early. The reader reads ahead of the playhead itself.
+	madvise(mapping, fileSize, MADV_NORMAL);
+	return file;
+}
+
+PcmFileMap::~PcmFileMap() {
+	munmap(mapping, mappedBytes);
+}
+
+bool PcmFileMap::setFormat(unsigned bits, bool isFloat, bool isBigEndian) {
+	bigEndian = isBigEndian;
+	if (isFloat) {
+		if (bits != 32) return false;
+		format = FLOAT32;
+	} else if (bits == 16) {
+		format = INT16;
+	} else if (bits == 24) {
+		format = INT24;
+	} else if (bits == 32) {
+		format = INT32;
+	} else {
+		return false;
+	}
+	bytesPerSample = bits / 8;
+	return true;
+}
+
+bool PcmFileMap::parseWave(size_t fileSize) {
+	const unsigned char *bytes = (const unsigned char*) mapping;
+	bool haveFormat = false;
+
+	size_t at = 12;
+	while (at + 8 <= fileSize) {
+		const unsigned char *chunk = &bytes[at];
+		size_t chunkSize = le32(&chunk[4]);
+
+		if (std::memcmp(chunk, "fmt ", 4) == 0) {
+			if (chunkSize < 16 || at + 8 + chunkSize > fileSize) return false;
+			unsigned audioFormat = le16(&chunk[8]);
+			if (audioFormat == 0xfffe && chunkSize >= 40) audioFormat = le16(&chunk[32]); // WAVE_FORMAT_EXTENSIBLE stores the real format in its sub-format GUID
+			if (audioFormat != 1 && audioFormat != 3) return false;
+
+			numChannels = le16(&chunk[10]);
+			sampleRate = le32(&chunk[12]);
+			if (!setFormat(le16(&chunk[22]), audioFormat == 3, false)) return false;
+			if (le16(&chunk[20]) != bytesPerSample * numChannels) return false; // samples padded out to a larger container
+			haveFormat = true;
+		} else if (std::memcmp(chunk, "data", 4) == 0) {
+			if (!haveFormat) return false;
+
+			//Recorders that are interrupted (or still recording) leave the data size unset, so trust the file size instead
+			if (chunkSize == 0 || at + 8 + chunkSize > fileSize) chunkSize = fileSize - at - 8;
+			data = &chunk[8];
+			numSamples = chunkSize / bytesPerSample;
+			numSamples -= numSamples % numChannels;
+			return true;
+		}
+
+		at += 8 + chunkSize + (chunkSize & 1);
+	}
+	return false;
+}
+
+bool PcmFileMap::parseAiff(size_t fileSize) {
+	const unsigned char *bytes = (const unsigned char*) mapping;
+	const bool compressed = (std::memcmp(&bytes[8], "AIFC", 4) == 0);
+	bool haveFormat = false;
+	size_t numFrames = 0;
+
+	size_t at = 12;
+	while (at + 8 <= fileSize) {
+		const unsigned char *chunk = &bytes[at];
+		size_t chunkSize = be32(&chunk[4]);
+
+		if (std::memcmp(chunk, "COMM", 4) == 0) {
+			if (chunkSize < 18 || at + 8 + chunkSize > fileSize) return false;
+			numChannels = be16(&chunk[8]);
+			numFrames = be32(&chunk[10]);
+			const unsigned bits = be16(&chunk[14]);
+			sampleRate = (unsigned) (be80(&chunk[16]) + 0.5);
+
+			bool isFloat = false, isBigEndian = true;
+			if (compressed) {
+				if (chunkSize < 22) return false;
+				const unsigned char *type = &chunk[26];
+				if (std::memcmp(type, "sowt", 4) == 0) {
+					isBigEndian = false;
+				} else if (std::memcmp(type, "fl32", 4) == 0 || std::memcmp(type, "FL32", 4) == 0) {
+					isFloat = true;
+				} else if (std::memcmp(type, "NONE", 4) != 0) {
+					return false;
+				}
+			}
+			if (!setFormat(bits, isFloat, isBigEndian)) return false;
+			haveFormat = true;
+		} else if (std::memcmp(chunk, "SSND", 4) == 0) {
+			if (!haveFormat || chunkSize < 8) return false;
+			const size_t offset = be32(&chunk[8]);
+			if (at + 16 + offset > fileSize) return false;
+			if (at + 8 + chunkSize > fileSize) chunkSize = fileSize - at - 8;
+			if (chunkSize < 8 + offset) return false;
+
+			data = &chunk[16 + offset];
+			numSamples = (chunkSize - 8 - offset) / bytesPerSample;
+			if (numFrames != 0 && numFrames * numChannels < numSamples) numSamples = numFrames * numChannels;
+			numSamples -= numSamples % numChannels;
+			return true;
+		}
+
+		at += 8 + chunkSize + (chunkSize & 1);
+	}
+	return false;
+}
+
+bool PcmFileMap::parseAu(size_t fileSize) {
+	const unsigned char *bytes = (const unsigned char*) mapping;
+	if (fileSize < 24) return false;
+
+	const size_t offset = be32(&bytes[4]);
+	size_t dataSize = be32(&bytes[8]);
+	const unsigned encoding = be32(&bytes[12]);
+	sampleRate = be32(&bytes[16]);
+	numChannels = be32(&bytes[20]);
+
+	bool ok;
+	switch (encoding) {
+		case 3: ok = setFormat(16, false, true); break;
+		case 4: ok = setFormat(24, false, true); break;
+		case 5: ok = setFormat(32, false, true); break;
+		case 6: ok = setFormat(32, true, true); break;
+		default: return false; // mu-law, a-law, and the rest are left to SoX
+	}
+	if (!ok || offset >= fileSize) return false;
+
+	if (dataSize == 0xffffffff || offset + dataSize > fileSize) dataSize = fileSize - offset;
+	data = &bytes[offset];
+	numSamples = dataSize / bytesPerSample;
+	numSamples -= numSamples % numChannels;
+	return true;
+}
+
+HOT void PcmFileMap::convert(float *dest, size_t position, size_t count) const {
+	const unsigned char *src = &data[position * bytesPerSample];
+	switch (format) {
+		case INT16:
+			if (bigEndian) int16BEToFloat(dest, src, count);
+			else int16ToFloat(dest, src, count);
+			break;
+		case INT24:
+			if (bigEndian) int24BEToFloat(dest, src, count);
+			else int24ToFloat(dest, src, count);
+			break;
+		case INT32:
+			if (bigEndian) {
+				int32BEToFloat(dest, src, count);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			} else if (((uintptr_t) src % sizeof(int32_t)) == 0) {
+				int32ToFloat(dest, (const int32_t*) src, count);
+#endif
+			} else {
+				int32ToFloat(dest, src, count);
+			}
+			break;
+		case FLOAT32:
+			if (bigEndian) float32BEToFloat(dest, src, count);
+			else std::memcpy((void*) dest, (const void*) src, count * sizeof(float));
+			break;
+	}
+}
+
+HOT const float *PcmFileMap::read(size_t position, size_t count, float *scratch) const {
+	if (position >= numSamples) {
+		std::memset((void*) scratch, 0, count * sizeof(float));
+		return scratch;
+	}
+
+	size_t available = numSamples - position;
+	if (available >= count) {
+		available = count;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		//native float data doesn't need converting at all
+		const unsigned char *src = &data[position * sizeof(float)];
+		if (format == FLOAT32 && !bigEndian && ((uintptr_t) src % sizeof(float)) == 0) return (const float*) src;
+#endif
+	}
+
+	convert(scratch, position, available);
+	if (available < count) std::memset((void*) &scratch[available], 0, (count - available) * sizeof(float));
+	return scratch;
+}
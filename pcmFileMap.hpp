@@ -0,0 +1,66 @@
+#ifndef PCMFILEMAP_HPP_
+#define PCMFILEMAP_HPP_
+
+#include <cstddef>
+
+#include "attributes.hpp"
+
+/*
+ * Native reader for uncompressed WAV, AIFF/AIFC, and AU files.
+ *
+ * The file is memory mapped and only the requested span is converted to floating point
+ * when it is read, so opening a file takes the same time regardless of its length, and
+ * seeking is free. For 32-bit float files in native byte order, no conversion is needed
+ * at all and read() returns a pointer straight into the mapping.
+ */
+class PcmFileMap {
+  private:
+	enum PACKED SampleFormat {
+		INT16,
+		INT24,
+		INT32,
+		FLOAT32
+	};
+
+	void *mapping;
+	size_t mappedBytes;
+	const unsigned char *data;
+
+	SampleFormat format;
+	bool bigEndian;
+	unsigned bytesPerSample;
+
+	unsigned sampleRate;
+	unsigned numChannels;
+	size_t numSamples;
+
+	PcmFileMap() {}
+
+	USERET bool parseWave(size_t fileSize);
+	USERET bool parseAiff(size_t fileSize);
+	USERET bool parseAu(size_t fileSize);
+	USERET bool setFormat(unsigned bits, bool isFloat, bool isBigEndian);
+
+	HOT void convert(float *dest, size_t position, size_t count) const;
+
+  public:
+	// Returns NULL if the file is not an uncompressed format we can read directly
+	USERET static PcmFileMap *open(const char *fname);
+	~PcmFileMap();
+
+	USERET INLINE unsigned getSampleRate() const { return sampleRate; }
+	USERET INLINE unsigned getNumChannels() const { return numChannels; }
+	USERET INLINE size_t getNumSamples() const { return numSamples; }
+
+	// Where in the file the sample at position is
+	USERET INLINE size_t byteOffset(size_t position) const { return (size_t) (data - (const unsigned char*) mapping) + position * bytesPerSample; }
+
+	/*
+	 * Returns count samples starting at position. The returned pointer is either into the
+	 * mapping or into scratch, which must have room for count samples. Samples past the end
+	 * of the file are read as silence.
+	 */
+	USERET HOT const float *read(size_t position, size_t count, float *scratch) const;
+};
+
+#endif /* PCMFILEMAP_HPP_ */
@@ -0,0 +1,116 @@
+#include "readAhead.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <chrono>
+
+static const size_t BLOCK_BYTES = 256 << 10; // read at a time, so a stream that jumps elsewhere is noticed quickly
+
+ReadAhead *ReadAhead::open(const char *fname, size_t windowBytes) {
+	const int fd = ::open(fname, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return NULL;
+	struct stat info;
+	if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+		::close(fd);
+		return NULL;
+	}
+
+	ReadAhead *readAhead = new ReadAhead();
+	readAhead->fd = fd;
+	readAhead->fileSize = (size_t) info.st_size;
+	readAhead->windowBytes = windowBytes;
+	readAhead->buffer = new unsigned char[BLOCK_BYTES];
+	for (int i = 0; i < MAX_READ_AHEAD_STREAMS; i++) {
+		readAhead->inUse[i] = false;
+		readAhead->offsets[i] = 0;
+		readAhead->prefetched[i] = 0;
+	}
+	readAhead->bytesRead = 0;
+	readAhead->nanosecondsReading = 0;
+	readAhead->alive = true;
+	readAhead->thread = new std::thread(&ReadAhead::prefetchLoop, readAhead);
+	return readAhead;
+}
+
+ReadAhead::~ReadAhead() {
+	waitLock.lock();
+	alive = false;
+	waitLock.unlock();
+	moved.notify_all();
+	thread->join();
+	delete thread;
+	delete[] buffer;
+	::close(fd);
+}
+
+int ReadAhead::attach() {
+	for (int i = 0; i < MAX_READ_AHEAD_STREAMS; i++) {
+		bool unused = false;
+		if (inUse[i].compare_exchange_strong(unused, true)) {
+			offsets[i].store(0, std::memory_order_release);
+			return i;
+		}
+	}
+	return -1;
+}
+
+void ReadAhead::detach(int stream) {
+	if (stream < 0 || stream >= MAX_READ_AHEAD_STREAMS) return;
+	inUse[stream].store(false, std::memory_order_release);
+}
+
+void ReadAhead::update(int stream, size_t offset) {
+	if (stream < 0 || stream >= MAX_READ_AHEAD_STREAMS) return;
+	offsets[stream].store(offset, std::memory_order_release);
+	moved.notify_one();
+}
+
+double ReadAhead::getThroughput() const {
+	const uint64_t nanoseconds = nanosecondsReading.load(std::memory_order_relaxed);
+	if (nanoseconds == 0) return 0.0;
+	return 1e9 * (double) bytesRead.load(std::memory_order_relaxed) / (double) nanoseconds;
+}
+
+// Reads one block ahead of whichever stream needs it. Returns false if every window is already read.
+bool ReadAhead::prefetchSome() {
+	for (int i = 0; i < MAX_READ_AHEAD_STREAMS; i++) {
+		if (!inUse[i].load(std::memory_order_acquire)) continue;
+		const size_t offset = offsets[i].load(std::memory_order_acquire);
+		const size_t end = (offset + windowBytes < fileSize) ? offset + windowBytes : fileSize;
+
+		//the stream jumped somewhere else, so start over from where it is now
+		if (prefetched[i] < offset || prefetched[i] > end) prefetched[i] = offset;
+		if (prefetched[i] >= end) continue;
+
+		//let the kernel start on the rest of the window while we wait for this block
+		posix_fadvise(fd, (off_t) prefetched[i], (off_t) (end - prefetched[i]), POSIX_FADV_WILLNEED);
+
+		const size_t count = (end - prefetched[i] < BLOCK_BYTES) ? end - prefetched[i] : BLOCK_BYTES;
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		const ssize_t got = pread(fd, buffer, count, (off_t) prefetched[i]);
+		const std::chrono::steady_clock::duration spent = std::chrono::steady_clock::now() - start;
+
+		//if the file can't be read, the decoder will find out for itself
+		if (got <= 0) {
+			prefetched[i] = end;
+			continue;
+		}
+		prefetched[i] += (size_t) got;
+		bytesRead.fetch_add((uint64_t) got, std::memory_order_relaxed);
+		nanosecondsReading.fetch_add((uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(spent).count(), std::memory_order_relaxed);
+		return true;
+	}
+	return false;
+}
+
+void ReadAhead::prefetchLoop() {
+	std::unique_lock<std::mutex> idle(waitLock, std::defer_lock);
+	while (alive) {
+		if (prefetchSome()) continue;
+
+		idle.lock();
+		if (alive) moved.wait_for(idle, std::chrono::milliseconds(100));
+		idle.unlock();
+	}
+}
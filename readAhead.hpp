@@ -0,0 +1,64 @@
+#ifndef READAHEAD_HPP_
+#define READAHEAD_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+#include "attributes.hpp"
+
+// Most decoders that can share one read-ahead thread
+#define MAX_READ_AHEAD_STREAMS 8
+
+/*
+ * Keeps the part of the audio file just ahead of each decoder in the page cache, so SoX never
+ * waits on the disk. This matters for files on network shares and spinning disks, where a cold
+ * read can take longer than the audio buffered ahead of the playhead.
+ *
+ * Each decoder attaches a stream and reports the byte offset it has read up to. A background
+ * thread asks the kernel to start reading the window after it, then reads it itself, so any
+ * waiting happens on that thread instead of the decoder's.
+ */
+class ReadAhead {
+  private:
+	int fd;
+	size_t fileSize;
+	size_t windowBytes;
+	unsigned char *buffer;
+
+	std::atomic<bool> inUse[MAX_READ_AHEAD_STREAMS];
+	std::atomic<size_t> offsets[MAX_READ_AHEAD_STREAMS];
+	size_t prefetched[MAX_READ_AHEAD_STREAMS]; // only touched by the read-ahead thread
+
+	std::atomic<uint64_t> bytesRead;
+	std::atomic<uint64_t> nanosecondsReading;
+
+	std::atomic<bool> alive;
+	std::thread *thread;
+	std::mutex waitLock;
+	std::condition_variable moved;
+
+	ReadAhead() {}
+	void prefetchLoop();
+	USERET bool prefetchSome();
+
+  public:
+	// Returns NULL if the file can't be opened
+	USERET static ReadAhead *open(const char *fname, size_t windowBytes);
+	~ReadAhead();
+
+	// Returns -1 if every stream is taken
+	USERET int attach();
+	void detach(int stream);
+
+	// Tells the read-ahead thread that the stream has read everything before offset
+	void update(int stream, size_t offset);
+
+	// How fast the read-ahead thread has read from the file so far, in bytes per second, or 0 if it hasn't read anything yet
+	USERET double getThroughput() const;
+};
+
+#endif /* READAHEAD_HPP_ */
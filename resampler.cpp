@@ -0,0 +1,110 @@
+#include "resampler.hpp"
+
+#include <cmath>
+
+// Taps on each side of an output sample when upsampling. Downsampling widens the filter to match its lower cutoff.
+static const unsigned HALF_TAPS = 16;
+static const unsigned MAX_TAPS = 128;
+
+// Ratios that would need more phases than this are left to the sound server
+static const unsigned MAX_PHASES = 4096;
+
+// Fraction of the lower Nyquist frequency that is kept. The rest is the filter's transition band.
+static const double PASSBAND = 0.95;
+
+static unsigned gcd(unsigned a, unsigned b) {
+	while (b != 0) {
+		const unsigned r = a % b;
+		a = b;
+		b = r;
+	}
+	return a;
+}
+
+Resampler *Resampler::create(unsigned inRate, unsigned outRate, unsigned numChannels) {
+	if (inRate == 0 || outRate == 0 || inRate == outRate || numChannels == 0) return NULL;
+	const unsigned divisor = gcd(inRate, outRate);
+	if (outRate / divisor > MAX_PHASES) return NULL;
+
+	Resampler *resampler = new Resampler();
+	resampler->numChannels = numChannels;
+	resampler->step = inRate / divisor;
+	resampler->numPhases = outRate / divisor;
+
+	const double cutoff = PASSBAND * ((outRate < inRate) ? (double) outRate / (double) inRate : 1.0);
+	unsigned numTaps = 2 * (unsigned) std::ceil((double) HALF_TAPS / cutoff);
+	numTaps = (numTaps + 7) & ~7u; //a multiple of 8, so the dot products split evenly into vectors
+	if (numTaps > MAX_TAPS) numTaps = MAX_TAPS;
+	resampler->numTaps = numTaps;
+
+	//Blackman windowed sinc, sampled at each tap's distance from the output sample
+	const double half = (double) (numTaps / 2);
+	resampler->filters = new float[(size_t) resampler->numPhases * numTaps];
+	for (unsigned phase = 0; phase < resampler->numPhases; phase++) {
+		float *taps = &resampler->filters[(size_t) phase * numTaps];
+		const double fraction = (double) phase / (double) resampler->numPhases;
+		double sum = 0.0;
+		for (unsigned k = 0; k < numTaps; k++) {
+			const double distance = (double) k - half + 1.0 - fraction;
+			const double x = M_PI * cutoff * distance;
+			const double sinc = (distance == 0.0) ? 1.0 : std::sin(x) / x;
+			const double w = (distance + half) / (2.0 * half);
+			const double window = (w <= 0.0 || w >= 1.0) ? 0.0 : 0.42 - 0.5 * std::cos(2.0 * M_PI * w) + 0.08 * std::cos(4.0 * M_PI * w);
+			taps[k] = (float) (sinc * window);
+			sum += taps[k];
+		}
+		//every phase passes DC at unity gain
+		for (unsigned k = 0; k < numTaps; k++) taps[k] = (float) ((double) taps[k] / sum);
+	}
+	return resampler;
+}
+
+Resampler::~Resampler() {
+	delete[] filters;
+}
+
+INLINE static float dot(const float *taps, const float *in, unsigned numTaps) {
+	//sum in blocks so the vectorizer doesn't need to reorder floating point additions itself
+	float sums[8] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+	for (unsigned k = 0; k < numTaps; k += 8) {
+		for (unsigned j = 0; j < 8; j++) sums[j] += taps[k+j] * in[k+j];
+	}
+	return ((sums[0] + sums[1]) + (sums[2] + sums[3])) + ((sums[4] + sums[5]) + (sums[6] + sums[7]));
+}
+
+MULTIVERSION HOT void Resampler::process(float *dest, size_t first, unsigned count, const float *src, int64_t srcFirst) const {
+	const uint64_t position = (uint64_t) first * step;
+	int64_t base = (int64_t) (position / numPhases) - (int64_t) (numTaps / 2) + 1 - srcFirst;
+	unsigned phase = (unsigned) (position % numPhases);
+	const unsigned whole = step / numPhases;
+	const unsigned part = step % numPhases;
+
+	if (numChannels == 1) {
+		for (unsigned i = 0; i < count; i++) {
+			dest[i] = dot(&filters[(size_t) phase * numTaps], &src[base], numTaps);
+			base += whole;
+			phase += part;
+			if (phase >= numPhases) {
+				phase -= numPhases;
+				base++;
+			}
+		}
+		return;
+	}
+
+	for (unsigned i = 0; i < count; i++) {
+		const float *taps = &filters[(size_t) phase * numTaps];
+		const float *in = &src[base * numChannels];
+		for (unsigned c = 0; c < numChannels; c++) {
+			float sum = 0.0f;
+			for (unsigned k = 0; k < numTaps; k++) sum += taps[k] * in[k * numChannels + c];
+			dest[i * numChannels + c] = sum;
+		}
+		base += whole;
+		phase += part;
+		if (phase >= numPhases) {
+			phase -= numPhases;
+			base++;
+		}
+	}
+}
@@ -0,0 +1,48 @@
+#ifndef RESAMPLER_HPP_
+#define RESAMPLER_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "attributes.hpp"
+
+/*
+ * Polyphase windowed sinc resampler between two fixed sample rates.
+ *
+ * It has no state of its own: each output frame depends only on the input frames around it,
+ * so any range of the output can be produced from the matching range of the input. This lets
+ * every decoder thread share one filter bank and seek freely.
+ */
+class Resampler {
+  private:
+	unsigned numChannels;
+	unsigned step; // input frames per numPhases output frames
+	unsigned numPhases;
+	unsigned numTaps;
+	float *filters; // numTaps coefficients for each phase
+
+	Resampler() {}
+
+  public:
+	// Returns NULL if the rates are the same, or too awkward a ratio to be worth resampling
+	USERET static Resampler *create(unsigned inRate, unsigned outRate, unsigned numChannels);
+	~Resampler();
+
+	// How many output frames there are for inputFrames input frames
+	USERET INLINE size_t outputFrames(size_t inputFrames) const { return (size_t) (((uint64_t) inputFrames * numPhases + step - 1) / step); }
+
+	// The input frames [firstInput(first), endInput(first + count)) produce the output frames [first, first + count)
+	USERET INLINE int64_t firstInput(size_t outputFrame) const { return (int64_t) ((uint64_t) outputFrame * step / numPhases) - (int64_t) (numTaps / 2) + 1; }
+	USERET INLINE int64_t endInput(size_t outputFrame) const { return firstInput(outputFrame - 1) + (int64_t) numTaps; }
+
+	// Most input frames needed for count output frames
+	USERET INLINE size_t maxInputFrames(size_t count) const { return (size_t) (((uint64_t) count * step + numPhases - 1) / numPhases) + numTaps + 1; }
+
+	/*
+	 * Writes count output frames starting at frame first to dest. src holds interleaved input
+	 * frames starting at frame srcFirst, and must cover every input frame they need.
+	 */
+	HOT void process(float *dest, size_t first, unsigned count, const float *src, int64_t srcFirst) const;
+};
+
+#endif /* RESAMPLER_HPP_ */
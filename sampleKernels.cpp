@@ -0,0 +1,109 @@
+#include "sampleKernels.hpp"
+
+#include <cstring>
+
+#include "attributes.hpp"
+
+/*
+ * These are written as simple loops that gcc can vectorize by itself. The MULTIVERSION
+ * attribute has it do so once for each instruction set, rather than writing intrinsics by hand.
+ */
+
+MULTIVERSION HOT void int16ToFloat(float *dest, const unsigned char *src, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		dest[i] = (float) (int16_t) (uint16_t) (src[2*i] | (src[2*i+1] << 8)) * (1.0f / 32768.0f);
+	}
+}
+
+MULTIVERSION HOT void int24ToFloat(float *dest, const unsigned char *src, size_t count) {
+	//shift the sample into the top 24 bits of an int32 so the sign is extended for us
+	for (size_t i = 0; i < count; i++) {
+		dest[i] = (float) (int32_t) (((uint32_t) src[3*i+2] << 24) | ((uint32_t) src[3*i+1] << 16) | ((uint32_t) src[3*i] << 8)) * (1.0f / 2147483648.0f);
+	}
+}
+
+MULTIVERSION HOT void int32ToFloat(float *dest, const unsigned char *src, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		dest[i] = (float) (int32_t) ((uint32_t) src[4*i] | ((uint32_t) src[4*i+1] << 8) | ((uint32_t) src[4*i+2] << 16) | ((uint32_t) src[4*i+3] << 24)) * (1.0f / 2147483648.0f);
+	}
+}
+
+MULTIVERSION HOT void int32ToFloat(float *dest, const int32_t *src, size_t count) {
+	//multiplying by a power of two is exact, so this rounds exactly the same as going through double
+	for (size_t i = 0; i < count; i++) dest[i] = (float) src[i] * (1.0f / 2147483648.0f);
+}
+
+MULTIVERSION HOT void int16ToFloat(float *dest, const int16_t *src, size_t count) {
+	for (size_t i = 0; i < count; i++) dest[i] = (float) src[i] * (1.0f / 32768.0f);
+}
+
+MULTIVERSION HOT void int16BEToFloat(float *dest, const unsigned char *src, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		dest[i] = (float) (int16_t) (uint16_t) ((src[2*i] << 8) | src[2*i+1]) * (1.0f / 32768.0f);
+	}
+}
+
+MULTIVERSION HOT void int24BEToFloat(float *dest, const unsigned char *src, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		dest[i] = (float) (int32_t) (((uint32_t) src[3*i] << 24) | ((uint32_t) src[3*i+1] << 16) | ((uint32_t) src[3*i+2] << 8)) * (1.0f / 2147483648.0f);
+	}
+}
+
+MULTIVERSION HOT void int32BEToFloat(float *dest, const unsigned char *src, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		dest[i] = (float) (int32_t) (((uint32_t) src[4*i] << 24) | ((uint32_t) src[4*i+1] << 16) | ((uint32_t) src[4*i+2] << 8) | (uint32_t) src[4*i+3]) * (1.0f / 2147483648.0f);
+	}
+}
+
+MULTIVERSION HOT void float32BEToFloat(float *dest, const unsigned char *src, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		const uint32_t bits = ((uint32_t) src[4*i] << 24) | ((uint32_t) src[4*i+1] << 16) | ((uint32_t) src[4*i+2] << 8) | (uint32_t) src[4*i+3];
+		std::memcpy(&dest[i], &bits, sizeof(float));
+	}
+}
+
+MULTIVERSION HOT void floatToInt16(int16_t *dest, const float *src, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		float value = src[i] * 32768.0f;
+		value = (value > 32767.0f) ? 32767.0f : value;
+		value = (value < -32768.0f) ? -32768.0f : value;
+		dest[i] = (int16_t) (int32_t) (value + ((value >= 0.0f) ? 0.5f : -0.5f));
+	}
+}
+
+MULTIVERSION HOT float dotProduct(const float *a, const float *b, size_t count) {
+	//sum in blocks so the vectorizer doesn't need to reorder floating point additions itself
+	float sums[8] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		for (unsigned j = 0; j < 8; j++) sums[j] += a[i+j] * b[i+j];
+	}
+	for (; i < count; i++) sums[0] += a[i] * b[i];
+	return ((sums[0] + sums[1]) + (sums[2] + sums[3])) + ((sums[4] + sums[5]) + (sums[6] + sums[7]));
+}
+
+MULTIVERSION HOT void downmix(float *dest, const float *src, size_t numFrames, unsigned numChannels) {
+	const float scale = 1.0f / (float) numChannels;
+	if (numChannels == 2) {
+		for (size_t i = 0; i < numFrames; i++) dest[i] = (src[2*i] + src[2*i+1]) * 0.5f;
+		return;
+	}
+	for (size_t i = 0; i < numFrames; i++) {
+		float sum = 0.0f;
+		for (unsigned j = 0; j < numChannels; j++) sum += src[i * numChannels + j];
+		dest[i] = sum * scale;
+	}
+}
+
+MULTIVERSION HOT void selectChannel(float *dest, const float *src, size_t numFrames, unsigned numChannels, unsigned channel) {
+	for (size_t i = 0; i < numFrames; i++) dest[i] = src[i * numChannels + channel];
+}
+
+void mapChannels(float *dest, const float *src, size_t numFrames, unsigned numChannels, ChannelMode mode) {
+	switch (mode) {
+		case MIX_CHANNELS: downmix(dest, src, numFrames, numChannels); break;
+		case LEFT_CHANNEL: selectChannel(dest, src, numFrames, numChannels, 0); break;
+		case RIGHT_CHANNEL: selectChannel(dest, src, numFrames, numChannels, (numChannels > 1) ? 1 : 0); break;
+		default: std::memcpy((void*) dest, (const void*) src, numFrames * numChannels * sizeof(float));
+	}
+}
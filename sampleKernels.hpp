@@ -0,0 +1,48 @@
+#ifndef SAMPLEKERNELS_HPP_
+#define SAMPLEKERNELS_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Loops over blocks of samples. Each one is compiled for AVX-512, AVX2, and plain SSE2,
+ * and the best version the CPU supports is picked when the program starts.
+ * Integer samples are converted to floating point samples in [-1, 1).
+ */
+
+void int16ToFloat(float *dest, const unsigned char *src, size_t count); // little endian
+void int24ToFloat(float *dest, const unsigned char *src, size_t count); // packed little endian
+void int32ToFloat(float *dest, const unsigned char *src, size_t count); // little endian, any alignment
+void int32ToFloat(float *dest, const int32_t *src, size_t count);
+void int16ToFloat(float *dest, const int16_t *src, size_t count); // native endian
+
+// Big endian samples, as in AIFF and AU files
+void int16BEToFloat(float *dest, const unsigned char *src, size_t count);
+void int24BEToFloat(float *dest, const unsigned char *src, size_t count); // packed
+void int32BEToFloat(float *dest, const unsigned char *src, size_t count);
+void float32BEToFloat(float *dest, const unsigned char *src, size_t count);
+
+// Rounds to the nearest int16, clipping anything outside [-1, 1)
+void floatToInt16(int16_t *dest, const float *src, size_t count);
+
+// Sum of a[i] * b[i]
+float dotProduct(const float *a, const float *b, size_t count);
+
+// Averages the channels of each frame of src into one sample of dest
+void downmix(float *dest, const float *src, size_t numFrames, unsigned numChannels);
+
+// Copies one channel of each frame of src into dest
+void selectChannel(float *dest, const float *src, size_t numFrames, unsigned numChannels, unsigned channel);
+
+// Which channels of a file are played
+enum ChannelMode {
+	ALL_CHANNELS,
+	MIX_CHANNELS, // downmixed to mono
+	LEFT_CHANNEL,
+	RIGHT_CHANNEL
+};
+
+// Writes numFrames frames of src to dest as the mode says. Every mode except ALL_CHANNELS gives one sample per frame.
+void mapChannels(float *dest, const float *src, size_t numFrames, unsigned numChannels, ChannelMode mode);
+
+#endif /* SAMPLEKERNELS_HPP_ */
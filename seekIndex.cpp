@@ -0,0 +1,650 @@
+#include "seekIndex.hpp"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+
+#include <sox.h>
+
+#include "config.hpp"
+
+static const char INDEX_MAGIC[8] = { 'O', 'S', 'I', 'D', 'X', '0', '2', '\0' };
+
+// The MP3 frame an indexed seek is checked at, and how many sample frames are compared there
+static const size_t VERIFY_POINT = 100;
+static const size_t VERIFY_FRAMES = 1152;
+// Largest difference allowed between the two decodes, about one 16-bit step
+static const sox_sample_t VERIFY_TOLERANCE = 1 << 16;
+
+INLINE static uint16_t be16(const unsigned char *p) { return (uint16_t) ((p[0] << 8) | p[1]); }
+INLINE static uint32_t be32(const unsigned char *p) { return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | (uint32_t) p[3]; }
+INLINE static uint32_t le32(const unsigned char *p) { return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24); }
+INLINE static uint64_t le64(const unsigned char *p) { return (uint64_t) le32(p) | ((uint64_t) le32(&p[4]) << 32); }
+
+SeekIndex *SeekIndex::open(const char *fname) {
+	int fd = ::open(fname, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return NULL;
+	unsigned char magic[4];
+	const bool gotMagic = (pread(fd, magic, 4, 0) == 4);
+	::close(fd);
+	if (!gotMagic) return NULL;
+
+	SeekIndex *index = new SeekIndex();
+	if (std::memcmp(magic, "fLaC", 4) == 0) {
+		index->container = FLAC;
+	} else if (std::memcmp(magic, "OggS", 4) == 0) {
+		index->container = OGG;
+	} else if (std::memcmp(magic, "ID3", 3) == 0 || (magic[0] == 0xff && (magic[1] & 0xe0) == 0xe0)) {
+		index->container = MP3;
+	} else {
+		delete index;
+		return NULL;
+	}
+
+	const size_t chars = std::strlen(fname) + 1;
+	index->filename = new char[chars];
+	std::memcpy(index->filename, fname, chars);
+	index->indexPath = getCacheFilePath(fname, "idx");
+	index->totalFrames = 0;
+	index->seekable = true;
+	index->alive = true;
+	index->ready = false;
+	index->builderThread = NULL;
+
+	if (index->load()) {
+		index->ready = true;
+	} else {
+		index->builderThread = new std::thread(&SeekIndex::builderLoop, index);
+	}
+	return index;
+}
+
+SeekIndex::~SeekIndex() {
+	alive = false;
+	if (builderThread != NULL) {
+		builderThread->join();
+		delete builderThread;
+	}
+	delete[] filename;
+}
+
+void SeekIndex::builderLoop() {
+	//building the index should never get in the way of the preloader, so run it at a lower priority
+	setpriority(PRIO_PROCESS, (id_t) syscall(SYS_gettid), 10);
+
+	int fd = ::open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return;
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0) {
+		::close(fd);
+		return;
+	}
+	const size_t fileSize = (size_t) info.st_size;
+	void *mapping = mmap(NULL, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (mapping == MAP_FAILED) return;
+	madvise(mapping, fileSize, MADV_SEQUENTIAL);
+
+	const unsigned char *bytes = (const unsigned char*) mapping;
+	bool ok = false;
+	switch (container) {
+		case MP3: ok = scanMp3(bytes, fileSize); break;
+		case FLAC: ok = scanFlac(bytes, fileSize); break;
+		case OGG: ok = scanOgg(bytes, fileSize); break;
+	}
+	if (ok && container == MP3) seekable = verifyMp3(bytes, fileSize);
+	munmap(mapping, fileSize);
+
+	if (ok && alive && !points.empty()) {
+		ready.store(true, std::memory_order_release);
+		save();
+	}
+}
+
+/* ---------------- MP3 ---------------- */
+
+struct Mp3FrameInfo {
+	size_t length;
+	unsigned samples;
+	unsigned sampleRate;
+	unsigned layer;
+	unsigned sideInfoBytes;
+	bool lsf; // MPEG 2 or 2.5
+	bool crc;
+};
+
+static const unsigned short MP3_BITRATES[2][3][16] = {
+	{ // MPEG 1
+		{ 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448, 0 },
+		{ 0, 32, 48, 56,  64,  80,  96, 112, 128, 160, 192, 224, 256, 320, 384, 0 },
+		{ 0, 32, 40, 48,  56,  64,  80,  96, 112, 128, 160, 192, 224, 256, 320, 0 }
+	}, { // MPEG 2 and 2.5
+		{ 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256, 0 },
+		{ 0,  8, 16, 24, 32, 40, 48,  56,  64,  80,  96, 112, 128, 144, 160, 0 },
+		{ 0,  8, 16, 24, 32, 40, 48,  56,  64,  80,  96, 112, 128, 144, 160, 0 }
+	}
+};
+
+// indexed by the version bits of the header (0 = MPEG 2.5, 1 = reserved, 2 = MPEG 2, 3 = MPEG 1)
+static const unsigned MP3_SAMPLE_RATES[4][3] = {
+	{ 11025, 12000, 8000 },
+	{ 0, 0, 0 },
+	{ 22050, 24000, 16000 },
+	{ 44100, 48000, 32000 }
+};
+
+static bool parseMp3Header(const unsigned char *p, Mp3FrameInfo &frame) {
+	if (p[0] != 0xff || (p[1] & 0xe0) != 0xe0) return false;
+
+	const unsigned version = (p[1] >> 3) & 3;
+	const unsigned layerBits = (p[1] >> 1) & 3;
+	const unsigned bitrateIndex = p[2] >> 4;
+	const unsigned rateIndex = (p[2] >> 2) & 3;
+	if (version == 1 || layerBits == 0 || bitrateIndex == 0 || bitrateIndex == 15 || rateIndex == 3) return false; // free format bitrates are not supported
+
+	frame.layer = 4 - layerBits;
+	frame.lsf = (version != 3);
+	frame.crc = !(p[1] & 1);
+	frame.sampleRate = MP3_SAMPLE_RATES[version][rateIndex];
+
+	const unsigned padding = (p[2] >> 1) & 1;
+	const bool mono = ((p[3] >> 6) == 3);
+	const size_t bitrate = 1000 * (size_t) MP3_BITRATES[frame.lsf ? 1 : 0][frame.layer - 1][bitrateIndex];
+
+	if (frame.layer == 1) {
+		frame.length = (12 * bitrate / frame.sampleRate + padding) * 4;
+		frame.samples = 384;
+		frame.sideInfoBytes = 0;
+	} else if (frame.layer == 2) {
+		frame.length = 144 * bitrate / frame.sampleRate + padding;
+		frame.samples = 1152;
+		frame.sideInfoBytes = 0;
+	} else {
+		frame.length = (frame.lsf ? 72 : 144) * bitrate / frame.sampleRate + padding;
+		frame.samples = frame.lsf ? 576 : 1152;
+		frame.sideInfoBytes = frame.lsf ? (mono ? 9 : 17) : (mono ? 17 : 32);
+	}
+
+	return (frame.length > 4u + (frame.crc ? 2u : 0u) + frame.sideInfoBytes);
+}
+
+bool SeekIndex::scanMp3(const unsigned char *bytes, size_t fileSize) {
+	size_t at = 0;
+	if (fileSize >= 10 && std::memcmp(bytes, "ID3", 3) == 0) {
+		//skip the ID3v2 tag. Its size is stored as a 28-bit "syncsafe" integer
+		at = 10 + (((size_t) (bytes[6] & 0x7f) << 21) | ((size_t) (bytes[7] & 0x7f) << 14) | ((size_t) (bytes[8] & 0x7f) << 7) | (size_t) (bytes[9] & 0x7f));
+		if (bytes[5] & 0x10) at += 10;
+	}
+
+	uint64_t frame = 0;
+	bool inSync = false;
+	while (at + 4 <= fileSize) {
+		if ((points.size() & 0x3ff) == 0 && !alive) return false;
+
+		Mp3FrameInfo info;
+		if (!parseMp3Header(&bytes[at], info) || at + info.length > fileSize) {
+			inSync = false;
+			at++;
+			continue;
+		}
+
+		//After losing sync, make sure this isn't just a frame sync pattern in the middle of some audio data by checking that another frame follows it
+		if (!inSync && at + info.length + 4 <= fileSize) {
+			Mp3FrameInfo next;
+			if (!parseMp3Header(&bytes[at + info.length], next) || next.sampleRate != info.sampleRate || next.layer != info.layer) {
+				at++;
+				continue;
+			}
+		}
+		inSync = true;
+
+		SeekPoint point;
+		point.offset = at;
+		point.frame = frame;
+		if (info.layer == 3) {
+			const unsigned char *sideInfo = &bytes[at + 4 + (info.crc ? 2 : 0)];
+			point.mainDataBegin = info.lsf ? sideInfo[0] : (uint16_t) ((sideInfo[0] << 1) | (sideInfo[1] >> 7));
+			point.mainDataSize = (uint16_t) (info.length - 4 - (info.crc ? 2 : 0) - info.sideInfoBytes);
+		} else {
+			point.mainDataBegin = 0;
+			point.mainDataSize = 0;
+		}
+		points.push_back(point);
+
+		frame += info.samples;
+		at += info.length;
+	}
+
+	totalFrames = frame;
+	return true;
+}
+
+// Reads count samples, or as many as there are. Returns how many were read.
+static size_t readSamples(sox_format_t *file, sox_sample_t *dest, size_t count) {
+	size_t read = 0;
+	while (read < count) {
+		const size_t more = sox_read(file, &dest[read], count - read);
+		if (more == 0) break;
+		read += more;
+	}
+	return read;
+}
+
+/*
+ * How many frames locate() discards depends on how libmad treats frames whose bit reservoir reaches back
+ * before where it started. Check it once, by decoding a few seconds in both from the start of the file
+ * and from where locate() says to, and comparing the two.
+ */
+bool SeekIndex::verifyMp3(const unsigned char *bytes, size_t fileSize) const {
+	if (points.size() < 2) return true;
+	const size_t k = (points.size() > VERIFY_POINT) ? VERIFY_POINT : points.size() - 1;
+	const uint64_t frame = points[k].frame;
+	SeekTarget target;
+	if (frame + VERIFY_FRAMES > totalFrames || !findTarget(frame, target)) return true;
+
+	sox_format_t *file = sox_open_mem_read((void*) bytes, fileSize, NULL, NULL, "mp3");
+	if (file == NULL) return true;
+	const size_t numChannels = file->signal.channels;
+	const size_t count = VERIFY_FRAMES * numChannels;
+	sox_sample_t *expected = new sox_sample_t[count];
+	sox_sample_t *actual = new sox_sample_t[count];
+
+	//straight through from the start
+	bool matches = true;
+	for (uint64_t skip = frame * numChannels; skip > 0 && matches;) {
+		const size_t read = readSamples(file, expected, (skip < count) ? (size_t) skip : count);
+		matches = (read > 0);
+		skip -= read;
+	}
+	matches = matches && readSamples(file, expected, count) == count;
+	sox_close(file);
+
+	//and from the seek target
+	file = matches ? sox_open_mem_read((void*) &bytes[target.offset], fileSize - (size_t) target.offset, NULL, NULL, "mp3") : NULL;
+	if (file != NULL) {
+		for (uint64_t skip = target.discardFrames * numChannels; skip > 0 && matches;) {
+			const size_t read = readSamples(file, actual, (skip < count) ? (size_t) skip : count);
+			matches = (read > 0);
+			skip -= read;
+		}
+		matches = matches && readSamples(file, actual, count) == count;
+		for (size_t i = 0; i < count && matches; i++) {
+			const int64_t difference = (int64_t) expected[i] - (int64_t) actual[i];
+			matches = (difference <= VERIFY_TOLERANCE && difference >= -VERIFY_TOLERANCE);
+		}
+		sox_close(file);
+	}
+
+	delete[] expected;
+	delete[] actual;
+	//if SoX couldn't decode either one, there's nothing to learn here
+	return matches || file == NULL;
+}
+
+/* ---------------- FLAC ---------------- */
+
+static uint8_t crc8(const unsigned char *data, size_t len) {
+	uint8_t crc = 0;
+	for (size_t i = 0; i < len; i++) {
+		crc ^= data[i];
+		for (int j = 0; j < 8; j++) crc = (crc & 0x80) ? (uint8_t) ((crc << 1) ^ 0x07) : (uint8_t) (crc << 1);
+	}
+	return crc;
+}
+
+/*
+ * Parses the FLAC frame header at p. On success, returns the header length (including the CRC)
+ * and sets number (the frame number, or the sample number for variable blocksize streams) and blockSize.
+ */
+static size_t parseFlacHeader(const unsigned char *p, size_t available, uint64_t &number, unsigned &blockSize) {
+	if (available < 6 || p[0] != 0xff || (p[1] & 0xfe) != 0xf8) return 0;
+
+	const unsigned blockCode = p[2] >> 4;
+	const unsigned rateCode = p[2] & 0x0f;
+	const unsigned channelCode = p[3] >> 4;
+	const unsigned sizeCode = (p[3] >> 1) & 7;
+	if (blockCode == 0 || rateCode == 15 || channelCode >= 11 || sizeCode == 3 || sizeCode == 7 || (p[3] & 1)) return 0;
+
+	//frame or sample number, in a UTF-8 style variable length encoding
+	size_t at = 4;
+	unsigned extra;
+	if (!(p[at] & 0x80)) { number = p[at]; extra = 0; }
+	else if ((p[at] & 0xe0) == 0xc0) { number = p[at] & 0x1f; extra = 1; }
+	else if ((p[at] & 0xf0) == 0xe0) { number = p[at] & 0x0f; extra = 2; }
+	else if ((p[at] & 0xf8) == 0xf0) { number = p[at] & 0x07; extra = 3; }
+	else if ((p[at] & 0xfc) == 0xf8) { number = p[at] & 0x03; extra = 4; }
+	else if ((p[at] & 0xfe) == 0xfc) { number = p[at] & 0x01; extra = 5; }
+	else if (p[at] == 0xfe) { number = 0; extra = 6; }
+	else return 0;
+	at++;
+
+	if (available < at + extra + 4) return 0;
+	for (unsigned i = 0; i < extra; i++, at++) {
+		if ((p[at] & 0xc0) != 0x80) return 0;
+		number = (number << 6) | (p[at] & 0x3f);
+	}
+
+	if (blockCode == 1) { blockSize = 192; }
+	else if (blockCode <= 5) { blockSize = 576u << (blockCode - 2); }
+	else if (blockCode == 6) { blockSize = p[at] + 1u; at += 1; }
+	else if (blockCode == 7) { blockSize = be16(&p[at]) + 1u; at += 2; }
+	else { blockSize = 256u << (blockCode - 8); }
+
+	if (rateCode == 12) at += 1;
+	else if (rateCode == 13 || rateCode == 14) at += 2;
+
+	if (available < at + 1 || crc8(p, at) != p[at]) return 0;
+	return at + 1;
+}
+
+bool SeekIndex::scanFlac(const unsigned char *bytes, size_t fileSize) {
+	//walk the metadata blocks to find the STREAMINFO block and the start of the audio frames
+	size_t at = 4;
+	const unsigned char *streamInfo = NULL;
+	while (at + 4 <= fileSize) {
+		const unsigned char blockHeader = bytes[at];
+		const size_t blockSize = ((size_t) bytes[at+1] << 16) | ((size_t) bytes[at+2] << 8) | (size_t) bytes[at+3];
+		if ((blockHeader & 0x7f) == 0 && blockSize >= 34 && at + 4 + 34 <= fileSize) streamInfo = &bytes[at+4];
+		at += 4 + blockSize;
+		if (blockHeader & 0x80) break;
+	}
+	if (streamInfo == NULL || at >= fileSize) return false;
+
+	/*
+	 * When seeking, we give the decoder a minimal header (just the STREAMINFO block) followed by
+	 * the frames we want to start from. Clear the MD5 signature so nothing tries to check it.
+	 */
+	static const unsigned char MINIMAL_HEADER[8] = { 'f', 'L', 'a', 'C', 0x80, 0x00, 0x00, 34 };
+	header.assign(MINIMAL_HEADER, MINIMAL_HEADER + 8);
+	header.insert(header.end(), streamInfo, streamInfo + 34);
+	std::memset(&header[8 + 18], 0, 16);
+
+	const uint64_t streamLength = ((uint64_t) (streamInfo[13] & 0x0f) << 32) | (uint64_t) be32(&streamInfo[14]);
+
+	/*
+	 * Look for frame headers. A sync code with a valid header CRC could still turn up inside
+	 * audio data by chance, so we also require each frame to start where the last one ended.
+	 */
+	uint64_t expected = 0;
+	unsigned fixedBlockSize = 0;
+	while (at + 6 <= fileSize) {
+		if ((points.size() & 0x3ff) == 0 && !alive) return false;
+		if (bytes[at] != 0xff || (bytes[at+1] & 0xfe) != 0xf8) {
+			at++;
+			continue;
+		}
+
+		uint64_t number;
+		unsigned blockSize;
+		const size_t headerBytes = parseFlacHeader(&bytes[at], fileSize - at, number, blockSize);
+		if (headerBytes == 0) {
+			at++;
+			continue;
+		}
+
+		const bool variable = (bytes[at+1] & 1);
+		if (!variable && fixedBlockSize == 0) fixedBlockSize = blockSize;
+		const uint64_t firstSample = variable ? number : number * fixedBlockSize;
+		if (firstSample != expected) {
+			at++;
+			continue;
+		}
+
+		SeekPoint point;
+		point.offset = at;
+		point.frame = firstSample;
+		point.mainDataBegin = 0;
+		point.mainDataSize = 0;
+		points.push_back(point);
+
+		expected += blockSize;
+		at += headerBytes;
+	}
+
+	totalFrames = (streamLength != 0) ? streamLength : expected;
+	return true;
+}
+
+/* ---------------- Ogg ---------------- */
+
+bool SeekIndex::scanOgg(const unsigned char *bytes, size_t fileSize) {
+	size_t at = 0;
+	bool haveStream = false;
+	uint32_t streamSerial = 0;
+	uint64_t preSkip = 0;
+	uint64_t lastGranule = 0;
+
+	while (at + 27 <= fileSize) {
+		if ((points.size() & 0x3ff) == 0 && !alive) return false;
+		if (std::memcmp(&bytes[at], "OggS", 4) != 0 || bytes[at+4] != 0) {
+			at++;
+			continue;
+		}
+
+		const size_t numSegments = bytes[at+26];
+		if (at + 27 + numSegments > fileSize) break;
+		size_t bodyBytes = 0;
+		for (size_t i = 0; i < numSegments; i++) bodyBytes += bytes[at + 27 + i];
+		const size_t pageBytes = 27 + numSegments + bodyBytes;
+		if (at + pageBytes > fileSize) break;
+
+		const uint64_t granule = le64(&bytes[at+6]);
+		const uint32_t serial = le32(&bytes[at+14]);
+		const unsigned char *body = &bytes[at + 27 + numSegments];
+
+		if (!haveStream) {
+			//the first page holds the codec's identification header. Only the first logical stream is played.
+			streamSerial = serial;
+			haveStream = true;
+			if (bodyBytes >= 19 && std::memcmp(body, "OpusHead", 8) == 0) preSkip = body[10] | ((uint64_t) body[11] << 8);
+		} else if (serial == streamSerial && granule != 0xffffffffffffffffull) {
+			SeekPoint point;
+			point.offset = at;
+			point.frame = granule;
+			point.mainDataBegin = 0;
+			point.mainDataSize = 0;
+			points.push_back(point);
+			lastGranule = granule;
+		}
+
+		at += pageBytes;
+	}
+
+	totalFrames = (lastGranule > preSkip) ? lastGranule - preSkip : 0;
+	return haveStream;
+}
+
+/* ---------------- Estimating ---------------- */
+
+const char *SeekIndex::getFileType() const {
+	switch (container) {
+		case MP3: return "mp3";
+		case FLAC: return "flac";
+		case OGG: return "ogg";
+	}
+	return NULL;
+}
+
+// How far the search for the first MP3 frame, or the last Ogg page, goes into the file
+static const size_t ESTIMATE_SEARCH_BYTES = 64 << 10;
+
+static uint64_t estimateMp3(const unsigned char *bytes, size_t fileSize) {
+	size_t at = 0;
+	if (fileSize >= 10 && std::memcmp(bytes, "ID3", 3) == 0) {
+		at = 10 + (((size_t) (bytes[6] & 0x7f) << 21) | ((size_t) (bytes[7] & 0x7f) << 14) | ((size_t) (bytes[8] & 0x7f) << 7) | (size_t) (bytes[9] & 0x7f));
+		if (bytes[5] & 0x10) at += 10;
+	}
+
+	//find the first frame that is followed by another one
+	const size_t searchEnd = (at + ESTIMATE_SEARCH_BYTES < fileSize) ? at + ESTIMATE_SEARCH_BYTES : fileSize;
+	Mp3FrameInfo info, next;
+	for (; at + 4 <= searchEnd; at++) {
+		if (!parseMp3Header(&bytes[at], info) || at + info.length + 4 > fileSize) continue;
+		if (parseMp3Header(&bytes[at + info.length], next) && next.sampleRate == info.sampleRate && next.layer == info.layer) break;
+	}
+	if (at + 4 > searchEnd) return 0;
+
+	//VBR encoders put the number of frames in a Xing (or Info) header in place of the first frame's audio
+	const size_t tag = at + 4 + (info.crc ? 2 : 0) + info.sideInfoBytes;
+	if (tag + 12 <= at + info.length && (std::memcmp(&bytes[tag], "Xing", 4) == 0 || std::memcmp(&bytes[tag], "Info", 4) == 0) && (bytes[tag+7] & 1)) {
+		return (uint64_t) be32(&bytes[tag+8]) * info.samples;
+	}
+
+	//otherwise assume every frame is the same size as the first
+	return (uint64_t) ((fileSize - at) / info.length) * info.samples;
+}
+
+static uint64_t estimateOgg(const unsigned char *bytes, size_t fileSize) {
+	if (fileSize < 27 + 19) return 0;
+	const uint32_t serial = le32(&bytes[14]);
+	const unsigned char *body = &bytes[27 + bytes[26]];
+	const uint64_t preSkip = (27 + (size_t) bytes[26] + 19 <= fileSize && std::memcmp(body, "OpusHead", 8) == 0) ? body[10] | ((uint64_t) body[11] << 8) : 0;
+
+	//search backwards for the last page of the first stream that ends a packet
+	const size_t searchStart = (fileSize > ESTIMATE_SEARCH_BYTES) ? fileSize - ESTIMATE_SEARCH_BYTES : 0;
+	for (size_t at = fileSize - 26; at-- > searchStart;) {
+		if (std::memcmp(&bytes[at], "OggS", 4) != 0 || bytes[at+4] != 0 || le32(&bytes[at+14]) != serial) continue;
+		const uint64_t granule = le64(&bytes[at+6]);
+		if (granule == 0xffffffffffffffffull) continue;
+		return (granule > preSkip) ? granule - preSkip : 0;
+	}
+	return 0;
+}
+
+uint64_t SeekIndex::estimateFrames() const {
+	if (container == FLAC) return 0;
+
+	int fd = ::open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return 0;
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0) {
+		::close(fd);
+		return 0;
+	}
+	const size_t fileSize = (size_t) info.st_size;
+	void *mapping = mmap(NULL, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (mapping == MAP_FAILED) return 0;
+
+	const uint64_t frames = (container == MP3) ? estimateMp3((const unsigned char*) mapping, fileSize) : estimateOgg((const unsigned char*) mapping, fileSize);
+	munmap(mapping, fileSize);
+	return frames;
+}
+
+/* ---------------- Seeking ---------------- */
+
+bool SeekIndex::locate(uint64_t frame, SeekTarget &target) const {
+	return isReady() && seekable && findTarget(frame, target);
+}
+
+bool SeekIndex::findTarget(uint64_t frame, SeekTarget &target) const {
+	if (container == OGG || frame >= totalFrames) return false;
+
+	//find the last frame that starts at or before the target
+	auto after = std::upper_bound(points.begin(), points.end(), frame, [](uint64_t f, const SeekPoint &p) { return f < p.frame; });
+	if (after == points.begin()) return false;
+	const size_t k = (size_t) (after - points.begin()) - 1;
+
+	if (container == FLAC) {
+		//FLAC frames can be decoded independently, so no pre-roll is needed
+		target.offset = points[k].offset;
+		target.header = header.data();
+		target.headerBytes = header.size();
+		target.fileType = "flac";
+		target.discardFrames = frame - points[k].frame;
+		return true;
+	}
+
+	/*
+	 * An MP3 frame can store part of its data in earlier frames (the bit reservoir), which
+	 * reaches back at most 511 bytes. Start decoding far enough back that frame k and every
+	 * frame after it has its full reservoir.
+	 */
+	size_t k0 = k;
+	unsigned reservoir = 0;
+	while (k0 > 0 && reservoir < 511) reservoir += points[--k0].mainDataSize;
+
+	//libmad skips any pre-roll frame whose reservoir reaches back before where we started, so only count the frames it will output
+	unsigned available = 0;
+	uint64_t decodedFrames = 0;
+	for (size_t j = k0; j < k; j++) {
+		if (points[j].mainDataBegin <= available) decodedFrames += points[j+1].frame - points[j].frame;
+		available += points[j].mainDataSize;
+	}
+
+	target.offset = points[k0].offset;
+	target.header = NULL;
+	target.headerBytes = 0;
+	target.fileType = "mp3";
+	target.discardFrames = decodedFrames + (frame - points[k].frame);
+	return true;
+}
+
+/* ---------------- Persistence ---------------- */
+
+struct PACKED IndexFileHeader {
+	char magic[8];
+	uint8_t container;
+	uint8_t seekable;
+	uint64_t totalFrames;
+	uint64_t numPoints;
+	uint32_t headerBytes;
+};
+
+bool SeekIndex::load() {
+	if (indexPath.empty()) return false;
+	std::FILE *in = std::fopen(indexPath.c_str(), "rb");
+	if (in == NULL) return false;
+
+	IndexFileHeader fileHeader;
+	bool ok = (std::fread(&fileHeader, sizeof(IndexFileHeader), 1, in) == 1 && std::memcmp(fileHeader.magic, INDEX_MAGIC, 8) == 0 &&
+		fileHeader.container == (uint8_t) container && fileHeader.numPoints > 0 && fileHeader.headerBytes <= 4096);
+
+	if (ok) {
+		header.resize(fileHeader.headerBytes);
+		points.resize((size_t) fileHeader.numPoints);
+		ok = (fileHeader.headerBytes == 0 || std::fread(header.data(), 1, header.size(), in) == header.size()) &&
+			std::fread(points.data(), sizeof(SeekPoint), points.size(), in) == points.size();
+		totalFrames = fileHeader.totalFrames;
+		seekable = (fileHeader.seekable != 0);
+	}
+	std::fclose(in);
+
+	if (!ok) {
+		points.clear();
+		header.clear();
+	} else {
+		utimensat(AT_FDCWD, indexPath.c_str(), NULL, 0); // the cache evicts by modification time
+	}
+	return ok;
+}
+
+void SeekIndex::save() const {
+	if (indexPath.empty()) return;
+
+	//write to a temporary file first so that a half-written index is never loaded
+	const std::string tempPath = indexPath + ".part";
+	std::FILE *out = std::fopen(tempPath.c_str(), "wb");
+	if (out == NULL) return;
+
+	IndexFileHeader fileHeader;
+	std::memcpy(fileHeader.magic, INDEX_MAGIC, 8);
+	fileHeader.container = (uint8_t) container;
+	fileHeader.seekable = seekable ? 1 : 0;
+	fileHeader.totalFrames = totalFrames;
+	fileHeader.numPoints = points.size();
+	fileHeader.headerBytes = (uint32_t) header.size();
+
+	bool ok = (std::fwrite(&fileHeader, sizeof(IndexFileHeader), 1, out) == 1) &&
+		(header.empty() || std::fwrite(header.data(), 1, header.size(), out) == header.size()) &&
+		std::fwrite(points.data(), sizeof(SeekPoint), points.size(), out) == points.size();
+	ok = (std::fclose(out) == 0) && ok;
+
+	if (!ok || std::rename(tempPath.c_str(), indexPath.c_str()) != 0) std::remove(tempPath.c_str());
+}
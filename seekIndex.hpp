@@ -0,0 +1,112 @@
+#ifndef SEEKINDEX_HPP_
+#define SEEKINDEX_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+
+#include "attributes.hpp"
+
+/*
+ * One entry per MP3 frame, FLAC frame, or Ogg page.
+ *  - For MP3 and FLAC, frame is the first sample frame (per-channel sample) decoded from it
+ *  - For Ogg, frame is the granule position, which is the sample frame just after the page ends
+ */
+struct PACKED SeekPoint {
+	uint64_t offset;
+	uint64_t frame;
+	uint16_t mainDataBegin; // MP3 only: how far back this frame's bit reservoir reaches
+	uint16_t mainDataSize; // MP3 only: bytes this frame contributes to the bit reservoir
+};
+
+// Where to start decoding in order to reach a sample frame
+struct SeekTarget {
+	uint64_t offset; // byte offset in the file to start decoding from
+	const unsigned char *header; // stream header to put in front of the data at offset (may be NULL)
+	size_t headerBytes;
+	const char *fileType; // SoX file type to decode the stream as
+	uint64_t discardFrames; // sample frames to skip after opening to land on the target
+};
+
+/*
+ * Frame level seek table for compressed audio files.
+ *
+ * SoX seeks in MP3 files by scanning from the start of the file, and has to be reopened
+ * after seeks near the end. After the file is opened, a background thread reads through
+ * the raw bytes of the file (without decoding anything) and records where each frame
+ * starts. Once the index is ready, the decoder can jump straight to the frame it needs and
+ * decode only the required pre-roll.
+ *
+ * MP3 and FLAC files are indexed by frame. Ogg (Vorbis and Opus) files are indexed by page,
+ * which gives their exact length, but SoX's own Ogg seeks already bisect on the page granule
+ * positions, so locate() leaves Ogg files to SoX.
+ *
+ * Where an MP3 seek has to start depends on the bit reservoir, so once an MP3 file is indexed, one
+ * indexed seek is checked against decoding from the start. If they differ, MP3 seeks are left to SoX too.
+ *
+ * Finished indexes are saved in ~/.cache/OpenScribe and reused when the file is opened again.
+ */
+class SeekIndex {
+  private:
+	enum PACKED Container {
+		MP3,
+		FLAC,
+		OGG
+	} container;
+
+	char *filename;
+	std::string indexPath;
+
+	std::vector<SeekPoint> points;
+	std::vector<unsigned char> header;
+	uint64_t totalFrames;
+	bool seekable; // false if locate() leaves seeks to SoX, because an indexed seek didn't land where it should
+
+	std::atomic<bool> alive;
+	std::atomic<bool> ready;
+	std::thread *builderThread;
+
+	SeekIndex() {}
+
+	void builderLoop();
+	USERET bool load();
+	void save() const;
+
+	USERET bool scanMp3(const unsigned char *bytes, size_t fileSize);
+	USERET bool scanFlac(const unsigned char *bytes, size_t fileSize);
+	USERET bool scanOgg(const unsigned char *bytes, size_t fileSize);
+	USERET bool verifyMp3(const unsigned char *bytes, size_t fileSize) const;
+	USERET bool findTarget(uint64_t frame, SeekTarget &target) const;
+
+  public:
+	// Returns NULL if the file is not a format we know how to index
+	USERET static SeekIndex *open(const char *fname);
+	~SeekIndex();
+
+	USERET INLINE bool isReady() const { return ready.load(std::memory_order_acquire); }
+
+	// Only valid once the index is ready
+	USERET INLINE uint64_t getTotalFrames() const { return totalFrames; }
+
+	// The SoX file type of the indexed file
+	USERET const char *getFileType() const;
+
+	/*
+	 * A quick guess at the length in sample frames, for before the index is ready. MP3 files use the
+	 * frame count in a Xing header if there is one, and the first frame's bitrate otherwise. Ogg files
+	 * use the granule position of the last page. Only the ends of the file are read. Returns 0 if
+	 * there is no guess.
+	 */
+	USERET uint64_t estimateFrames() const;
+
+	/*
+	 * Finds where to start decoding to land exactly on the given sample frame.
+	 * Returns false if the index is not ready yet or cannot seek in this format.
+	 */
+	USERET bool locate(uint64_t frame, SeekTarget &target) const;
+};
+
+#endif /* SEEKINDEX_HPP_ */
@@ -0,0 +1,94 @@
+#include "segmentCache.hpp"
+
+#include <cstring>
+
+SegmentCache *SegmentCache::create(unsigned chunkSize, size_t maxBytes) {
+	const size_t numSlots = maxBytes / (chunkSize * sizeof(float));
+	if (chunkSize == 0 || numSlots < 2) return NULL;
+
+	SegmentCache *cache = new SegmentCache();
+	cache->chunkSize = chunkSize;
+	cache->numSlots = (unsigned) numSlots;
+	cache->slotsUsed = 0;
+	cache->slab = new float[numSlots * chunkSize];
+	cache->slots = new Slot[numSlots];
+	cache->clock = 0;
+	return cache;
+}
+
+SegmentCache::~SegmentCache() {
+	delete[] slab;
+	delete[] slots;
+}
+
+bool SegmentCache::contains(unsigned chunk) {
+	std::lock_guard<std::mutex> guard(lock);
+	return chunkToSlot.count(chunk) != 0;
+}
+
+/*
+ * Each chunk is scored by how many insertions ago it was last used plus how many chunks it is
+ * away from the playhead, so old chunks near the playhead outlive recent ones far away from it.
+ */
+unsigned SegmentCache::chooseVictim(unsigned playheadChunk) const {
+	unsigned victim = 0;
+	uint64_t worst = 0;
+	for (unsigned i = 0; i < numSlots; i++) {
+		const uint64_t distance = (slots[i].chunk > playheadChunk) ? slots[i].chunk - playheadChunk : playheadChunk - slots[i].chunk;
+		const uint64_t score = (clock - slots[i].lastUsed) + distance;
+		if (score >= worst) {
+			worst = score;
+			victim = i;
+		}
+	}
+	return victim;
+}
+
+void SegmentCache::insert(unsigned chunk, const float *data, unsigned count, uint64_t playhead) {
+	if (count > chunkSize) count = chunkSize;
+
+	std::lock_guard<std::mutex> guard(lock);
+	if (chunkToSlot.count(chunk) != 0) return;
+
+	unsigned slot;
+	if (slotsUsed < numSlots) {
+		slot = slotsUsed++;
+	} else {
+		slot = chooseVictim((unsigned) (playhead / chunkSize));
+		chunkToSlot.erase(slots[slot].chunk);
+	}
+
+	float *dest = &slab[(size_t) slot * chunkSize];
+	std::memcpy((void*) dest, (const void*) data, count * sizeof(float));
+	if (count < chunkSize) std::memset((void*) &dest[count], 0, (chunkSize - count) * sizeof(float));
+
+	slots[slot].chunk = chunk;
+	slots[slot].lastUsed = ++clock;
+	chunkToSlot[chunk] = slot;
+}
+
+bool SegmentCache::copy(float *dest, uint64_t position, unsigned count) {
+	std::lock_guard<std::mutex> guard(lock);
+
+	//make sure every chunk is there before copying anything
+	const unsigned first = (unsigned) (position / chunkSize);
+	const unsigned last = (unsigned) ((position + count - 1) / chunkSize);
+	for (unsigned chunk = first; chunk <= last; chunk++) {
+		if (chunkToSlot.count(chunk) == 0) return false;
+	}
+
+	clock++;
+	while (count > 0) {
+		const unsigned chunk = (unsigned) (position / chunkSize);
+		const unsigned offset = (unsigned) (position % chunkSize);
+		const unsigned n = (count < chunkSize - offset) ? count : chunkSize - offset;
+		const unsigned slot = chunkToSlot[chunk];
+
+		std::memcpy((void*) dest, (const void*) &slab[(size_t) slot * chunkSize + offset], n * sizeof(float));
+		slots[slot].lastUsed = clock;
+		dest += n;
+		position += n;
+		count -= n;
+	}
+	return true;
+}
@@ -0,0 +1,54 @@
+#ifndef SEGMENTCACHE_HPP_
+#define SEGMENTCACHE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+#include "attributes.hpp"
+
+/*
+ * In-memory cache of recently decoded audio, in fixed size chunks aligned to multiples of the
+ * chunk size. When the preloader is reset to a new position, it copies whatever it can from
+ * here instead of decoding it again, so jumping back and forth between two spots in a file
+ * only has to decode each of them once.
+ *
+ * All memory is allocated up front. When the cache is full, the chunk that was used longest
+ * ago and is furthest from the playhead is replaced.
+ */
+class SegmentCache {
+  private:
+	struct Slot {
+		unsigned chunk;
+		uint64_t lastUsed;
+	};
+
+	unsigned chunkSize;
+	unsigned numSlots;
+	unsigned slotsUsed;
+	float *slab;
+	Slot *slots;
+	std::map<unsigned, unsigned> chunkToSlot;
+	uint64_t clock;
+	std::mutex lock;
+
+	SegmentCache() {}
+	USERET unsigned chooseVictim(unsigned playheadChunk) const;
+
+  public:
+	// Returns NULL if maxBytes is too small to be worth caching anything
+	USERET static SegmentCache *create(unsigned chunkSize, size_t maxBytes);
+	~SegmentCache();
+
+	USERET INLINE unsigned getChunkSize() const { return chunkSize; }
+	USERET bool contains(unsigned chunk);
+
+	// Stores count samples (at most one chunk) of the given chunk. The rest of the chunk is filled with silence.
+	void insert(unsigned chunk, const float *data, unsigned count, uint64_t playhead);
+
+	// Copies count samples starting at position into dest if they are all cached. Returns false otherwise.
+	USERET bool copy(float *dest, uint64_t position, unsigned count);
+};
+
+#endif /* SEGMENTCACHE_HPP_ */
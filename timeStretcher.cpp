@@ -0,0 +1,108 @@
+#include "timeStretcher.hpp"
+
+#include <cmath>
+#include <chrono>
+
+#include <sonic.h>
+
+#include "wsolaStretcher.hpp"
+
+// How much leftover output sonic hands back at once when it is cleared
+static const unsigned SONIC_TRASH_FRAMES = 4096;
+
+// libsonic's PICOLA. The quality setting turns off the shortcuts it takes when searching for pitch periods.
+class SonicStretcher : public TimeStretcher {
+  private:
+	sonicStream stream;
+	float *trash;
+
+  public:
+	SonicStretcher(StretchQuality quality, unsigned sampleRate, unsigned numChannels) {
+		stream = sonicCreateStream((int) sampleRate, (int) numChannels);
+		sonicSetQuality(stream, (quality == STRETCH_FAST) ? 0 : 1);
+		trash = new float[SONIC_TRASH_FRAMES * numChannels];
+	}
+	~SonicStretcher() {
+		sonicDestroyStream(stream);
+		delete[] trash;
+	}
+
+	void setSpeed(float speed) { sonicSetSpeed(stream, speed); }
+	void write(const float *src, unsigned numFrames) { sonicWriteFloatToStream(stream, (float*) src, (int) numFrames); }
+	USERET unsigned available() const { return (unsigned) sonicSamplesAvailable(stream); }
+	unsigned read(float *dest, unsigned numFrames) { return (unsigned) sonicReadFloatFromStream(stream, dest, (int) numFrames); }
+	void clear() {
+		sonicFlushStream(stream);
+		while (sonicReadFloatFromStream(stream, trash, (int) SONIC_TRASH_FRAMES) > 0);
+	}
+};
+
+TimeStretcher *TimeStretcher::create(StretchEngine engine, StretchQuality quality, unsigned sampleRate, unsigned numChannels) {
+	if (engine == SONIC_STRETCHER) return new SonicStretcher(quality, sampleRate, numChannels);
+	return new WsolaStretcher(quality, sampleRate, numChannels);
+}
+
+// Something like a voice: a gliding pitch with harmonics, broken into syllables, over a little noise
+static void synthesizeSpeech(float *dest, size_t numFrames, unsigned numChannels, unsigned sampleRate) {
+	uint32_t noise = 12345;
+	double phase = 0.0;
+	for (size_t i = 0; i < numFrames; i++) {
+		const double t = (double) i / (double) sampleRate;
+		phase += 2.0 * M_PI * (120.0 + 30.0 * std::sin(2.0 * M_PI * 0.7 * t)) / (double) sampleRate;
+		double voice = 0.0;
+		for (int k = 1; k <= 12; k++) voice += std::sin((double) k * phase) / (double) k;
+		const double syllables = 0.5 + 0.5 * std::sin(2.0 * M_PI * 4.0 * t);
+		noise = noise * 1664525u + 1013904223u;
+		const double hiss = ((double) (noise >> 8) / (double) (1 << 24) - 0.5) * 0.02;
+		for (unsigned c = 0; c < numChannels; c++) dest[i * numChannels + c] = (float) (0.2 * voice * syllables + hiss);
+	}
+}
+
+void TimeStretcher::benchmark(std::ostream &out) {
+	static const unsigned SAMPLE_RATE = 44100;
+	static const unsigned SECONDS = 20;
+	static const unsigned BLOCK_FRAMES = 1024;
+	static const float SPEEDS[] = { 0.3f, 0.5f, 0.75f };
+	static const unsigned CHANNELS[] = { 1, 2 };
+	static const struct {
+		StretchEngine engine;
+		StretchQuality quality;
+		const char *name;
+	} ENGINES[] = {
+		{ WSOLA_STRETCHER, STRETCH_FAST, "WSOLA, fast" },
+		{ WSOLA_STRETCHER, STRETCH_BALANCED, "WSOLA, balanced" },
+		{ WSOLA_STRETCHER, STRETCH_BEST, "WSOLA, best" },
+		{ SONIC_STRETCHER, STRETCH_FAST, "Sonic, fast" },
+		{ SONIC_STRETCHER, STRETCH_BEST, "Sonic, best" }
+	};
+
+	const size_t numFrames = (size_t) SAMPLE_RATE * SECONDS;
+	out << "Stretching " << SECONDS << " seconds of " << SAMPLE_RATE << " Hz audio. Higher is faster." << std::endl;
+	for (const unsigned numChannels : CHANNELS) {
+		float *source = new float[numFrames * numChannels];
+		float *sink = new float[BLOCK_FRAMES * numChannels];
+		synthesizeSpeech(source, numFrames, numChannels, SAMPLE_RATE);
+
+		for (const auto &engine : ENGINES) {
+			for (const float speed : SPEEDS) {
+				TimeStretcher *stretcher = create(engine.engine, engine.quality, SAMPLE_RATE, numChannels);
+				stretcher->setSpeed(speed);
+
+				size_t produced = 0;
+				const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				for (size_t at = 0; at + BLOCK_FRAMES <= numFrames; at += BLOCK_FRAMES) {
+					stretcher->write(&source[at * numChannels], BLOCK_FRAMES);
+					while (stretcher->available() > 0) produced += stretcher->read(sink, BLOCK_FRAMES);
+				}
+				const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				delete stretcher;
+
+				const double realtime = ((double) produced / (double) SAMPLE_RATE) / seconds;
+				out << engine.name << ", " << (numChannels == 1 ? "mono" : "stereo") << ", " << (int) (100.0f * speed + 0.5f) << "% speed: "
+					<< (int) (realtime + 0.5) << "x real time" << std::endl;
+			}
+		}
+		delete[] source;
+		delete[] sink;
+	}
+}
@@ -0,0 +1,55 @@
+#ifndef TIMESTRETCHER_HPP_
+#define TIMESTRETCHER_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+#include "attributes.hpp"
+
+// Which library slows the audio down
+enum StretchEngine {
+	WSOLA_STRETCHER, // built in, clearer at low speeds
+	SONIC_STRETCHER // libsonic, uses the least processing time
+};
+
+// How hard the engine works to find where each piece of audio lines up with the last
+enum StretchQuality {
+	STRETCH_FAST,
+	STRETCH_BALANCED,
+	STRETCH_BEST
+};
+
+/*
+ * Changes the speed of audio without changing its pitch. Interleaved frames are written in, and
+ * the slowed frames can be read back out once the engine has enough input to produce them.
+ * Changing the speed applies to the input that hasn't been stretched yet, so it doesn't
+ * interrupt the audio.
+ *
+ * Nothing here is thread safe. Each stretcher is only used by one thread at a time.
+ */
+class TimeStretcher {
+  public:
+	USERET static TimeStretcher *create(StretchEngine engine, StretchQuality quality, unsigned sampleRate, unsigned numChannels);
+	virtual ~TimeStretcher() {}
+
+	virtual void setSpeed(float speed) = 0;
+	virtual void write(const float *src, unsigned numFrames) = 0;
+
+	// How many stretched frames are ready to read
+	USERET virtual unsigned available() const = 0;
+
+	// Returns how many frames were copied to dest, which is at most numFrames
+	virtual unsigned read(float *dest, unsigned numFrames) = 0;
+
+	// Throws away all input and output, so the next write starts a new stream. Doesn't allocate.
+	virtual void clear() = 0;
+
+	/*
+	 * Times every engine and quality at several speeds and channel counts on synthetic audio, and
+	 * writes how many times faster than real time each one runs.
+	 */
+	static void benchmark(std::ostream &out);
+};
+
+#endif /* TIMESTRETCHER_HPP_ */
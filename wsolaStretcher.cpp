@@ -0,0 +1,195 @@
+#include "wsolaStretcher.hpp"
+
+#include <cmath>
+#include <cstring>
+
+#include "sampleKernels.hpp"
+
+struct WsolaSettings {
+	unsigned frameMilliseconds;
+	unsigned searchMilliseconds; // how far each frame may move either way
+	unsigned searchStep;
+};
+
+// Longer frames and a wider search sound smoother on low voices, and cost more
+static const WsolaSettings SETTINGS[] = {
+	{ 20, 6, 4 }, // STRETCH_FAST
+	{ 25, 10, 2 }, // STRETCH_BALANCED
+	{ 30, 12, 1 } // STRETCH_BEST
+};
+
+WsolaStretcher::WsolaStretcher(StretchQuality quality, unsigned sampleRate, unsigned numChannels) : numChannels(numChannels) {
+	const WsolaSettings &settings = SETTINGS[(quality > STRETCH_BEST) ? STRETCH_BEST : quality];
+	hop = (sampleRate * settings.frameMilliseconds / 1000 + 1) / 2;
+	frameLength = 2 * hop;
+	searchRadius = sampleRate * settings.searchMilliseconds / 1000;
+	searchStep = settings.searchStep;
+	speed = 1.0f;
+
+	//periodic Hann window, so two half-overlapping frames always add up to 1
+	window = new float[frameLength];
+	for (unsigned i = 0; i < frameLength; i++) window[i] = (float) (0.5 - 0.5 * std::cos(2.0 * M_PI * (double) i / (double) frameLength));
+	tail = new float[hop * numChannels];
+
+	inputCapacity = 4 * frameLength + 2 * searchRadius;
+	input = new float[inputCapacity * numChannels];
+	mono = new float[inputCapacity];
+	outputCapacity = 4 * frameLength;
+	output = new float[outputCapacity * numChannels];
+	clear();
+}
+
+WsolaStretcher::~WsolaStretcher() {
+	delete[] window;
+	delete[] tail;
+	delete[] input;
+	delete[] mono;
+	delete[] output;
+}
+
+void WsolaStretcher::clear() {
+	std::memset((void*) tail, 0, hop * numChannels * sizeof(float));
+	inputFrames = 0;
+	analysis = 0.0;
+	previous = 0;
+	started = false;
+	outputStart = 0;
+	outputFrames = 0;
+}
+
+// Makes room for numFrames frames of input in total
+void WsolaStretcher::reserveInput(size_t numFrames) {
+	if (numFrames <= inputCapacity) return;
+	while (inputCapacity < numFrames) inputCapacity *= 2;
+	float *grown = new float[inputCapacity * numChannels];
+	std::memcpy((void*) grown, (const void*) input, inputFrames * numChannels * sizeof(float));
+	delete[] input;
+	input = grown;
+	grown = new float[inputCapacity];
+	std::memcpy((void*) grown, (const void*) mono, inputFrames * sizeof(float));
+	delete[] mono;
+	mono = grown;
+}
+
+// Makes room for numFrames more frames of output after what is already there
+void WsolaStretcher::reserveOutput(size_t numFrames) {
+	if (outputStart + outputFrames + numFrames <= outputCapacity) return;
+	if (outputStart != 0) {
+		std::memmove((void*) output, (const void*) &output[outputStart * numChannels], outputFrames * numChannels * sizeof(float));
+		outputStart = 0;
+	}
+	if (outputFrames + numFrames <= outputCapacity) return;
+	while (outputCapacity < outputFrames + numFrames) outputCapacity *= 2;
+	float *grown = new float[outputCapacity * numChannels];
+	std::memcpy((void*) grown, (const void*) output, outputFrames * numChannels * sizeof(float));
+	delete[] output;
+	output = grown;
+}
+
+/*
+ * Returns the start of the frame in [from, to] whose first half best matches what would have
+ * followed the last frame in the input, by normalized cross-correlation. Every searchStep-th
+ * candidate is tried first, then the ones around the best of those.
+ */
+HOT int64_t WsolaStretcher::findBestFrame(int64_t from, int64_t to) const {
+	const float *target = &mono[previous + hop];
+	int64_t best = from;
+	double bestScore = -HUGE_VAL;
+
+	//slide the energy of the candidate along with it instead of summing it again each time
+	double energy = (double) dotProduct(&mono[from], &mono[from], hop);
+	for (int64_t at = from; at <= to; at++) {
+		if ((at - from) % searchStep == 0) {
+			const double score = (double) dotProduct(&mono[at], target, hop) / std::sqrt((energy > 0.0 ? energy : 0.0) + 1e-9);
+			if (score > bestScore) {
+				bestScore = score;
+				best = at;
+			}
+		}
+		energy += (double) mono[at + hop] * mono[at + hop] - (double) mono[at] * mono[at];
+	}
+	if (searchStep == 1) return best;
+
+	const int64_t first = (best - (int64_t) searchStep + 1 > from) ? best - (int64_t) searchStep + 1 : from;
+	const int64_t last = (best + (int64_t) searchStep - 1 < to) ? best + (int64_t) searchStep - 1 : to;
+	const int64_t coarse = best;
+	for (int64_t at = first; at <= last; at++) {
+		if (at == coarse) continue;
+		const double candidateEnergy = (double) dotProduct(&mono[at], &mono[at], hop);
+		const double score = (double) dotProduct(&mono[at], target, hop) / std::sqrt(candidateEnergy + 1e-9);
+		if (score > bestScore) {
+			bestScore = score;
+			best = at;
+		}
+	}
+	return best;
+}
+
+// Overlaps the frame starting at start with the tail of the last one, and outputs the first half of it
+HOT void WsolaStretcher::addFrame(int64_t start) {
+	reserveOutput(hop);
+	float *dest = &output[(outputStart + outputFrames) * numChannels];
+	const float *src = &input[start * numChannels];
+	for (unsigned i = 0; i < hop; i++) {
+		for (unsigned c = 0; c < numChannels; c++) dest[i * numChannels + c] = tail[i * numChannels + c] + window[i] * src[i * numChannels + c];
+	}
+	src += hop * numChannels;
+	for (unsigned i = 0; i < hop; i++) {
+		for (unsigned c = 0; c < numChannels; c++) tail[i * numChannels + c] = window[hop + i] * src[i * numChannels + c];
+	}
+
+	outputFrames += hop;
+	previous = start;
+	analysis += (double) hop * (double) speed;
+	started = true;
+}
+
+// Drops the input that no frame can start in any more
+void WsolaStretcher::discardInput() {
+	int64_t keep = previous + hop;
+	const int64_t lowest = (int64_t) (analysis + 0.5) - (int64_t) searchRadius;
+	if (lowest < keep) keep = lowest;
+	if (keep <= 0) return;
+	if ((size_t) keep > inputFrames) keep = (int64_t) inputFrames;
+
+	inputFrames -= (size_t) keep;
+	std::memmove((void*) input, (const void*) &input[keep * numChannels], inputFrames * numChannels * sizeof(float));
+	std::memmove((void*) mono, (const void*) &mono[keep], inputFrames * sizeof(float));
+	previous -= keep;
+	analysis -= (double) keep;
+}
+
+HOT void WsolaStretcher::write(const float *src, unsigned numFrames) {
+	reserveInput(inputFrames + numFrames);
+	std::memcpy((void*) &input[inputFrames * numChannels], (const void*) src, (size_t) numFrames * numChannels * sizeof(float));
+	if (numChannels == 1) {
+		std::memcpy((void*) &mono[inputFrames], (const void*) src, numFrames * sizeof(float));
+	} else {
+		downmix(&mono[inputFrames], src, numFrames, numChannels);
+	}
+	inputFrames += numFrames;
+
+	//the first frame has nothing to line up with
+	if (!started) {
+		if (inputFrames < frameLength) return;
+		addFrame(0);
+	}
+
+	while (true) {
+		const int64_t center = (int64_t) (analysis + 0.5);
+		const int64_t to = center + (int64_t) searchRadius;
+		if (to + (int64_t) frameLength > (int64_t) inputFrames) break;
+		const int64_t from = (center > (int64_t) searchRadius) ? center - (int64_t) searchRadius : 0;
+		addFrame(findBestFrame(from, to));
+	}
+	discardInput();
+}
+
+unsigned WsolaStretcher::read(float *dest, unsigned numFrames) {
+	if (numFrames > outputFrames) numFrames = (unsigned) outputFrames;
+	std::memcpy((void*) dest, (const void*) &output[outputStart * numChannels], (size_t) numFrames * numChannels * sizeof(float));
+	outputStart += numFrames;
+	outputFrames -= numFrames;
+	if (outputFrames == 0) outputStart = 0;
+	return numFrames;
+}
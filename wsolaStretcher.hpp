@@ -0,0 +1,56 @@
+#ifndef WSOLASTRETCHER_HPP_
+#define WSOLASTRETCHER_HPP_
+
+#include "timeStretcher.hpp"
+
+/*
+ * Waveform similarity overlap-add. The output is built from half-overlapping Hann windowed frames
+ * of the input. Each frame is taken from near where the speed says it should come from, but
+ * shifted by up to searchRadius frames to wherever it best continues the waveform of the frame
+ * before it, so pitch periods line up and nothing is smeared. The search runs on a mono mix of
+ * the input, and the frames are copied from every channel.
+ */
+class WsolaStretcher : public TimeStretcher {
+  private:
+	unsigned numChannels;
+	unsigned frameLength;
+	unsigned hop; // half of frameLength: how far apart output frames start
+	unsigned searchRadius;
+	unsigned searchStep; // candidates checked on the first pass, before refining around the best
+	float speed;
+
+	float *window;
+	float *tail; // the second half of the last frame, already windowed
+
+	// Input that may still be needed. Positions below are relative to the start of it.
+	float *input;
+	float *mono;
+	size_t inputCapacity;
+	size_t inputFrames;
+	double analysis; // where the next frame would start if nothing were searched
+	int64_t previous; // where the last frame started
+	bool started;
+
+	float *output;
+	size_t outputCapacity;
+	size_t outputStart;
+	size_t outputFrames;
+
+	void reserveInput(size_t numFrames);
+	void reserveOutput(size_t numFrames);
+	USERET HOT int64_t findBestFrame(int64_t from, int64_t to) const;
+	HOT void addFrame(int64_t start);
+	void discardInput();
+
+  public:
+	WsolaStretcher(StretchQuality quality, unsigned sampleRate, unsigned numChannels);
+	~WsolaStretcher();
+
+	void setSpeed(float newSpeed) { speed = newSpeed; }
+	HOT void write(const float *src, unsigned numFrames);
+	USERET unsigned available() const { return (unsigned) outputFrames; }
+	unsigned read(float *dest, unsigned numFrames);
+	void clear();
+};
+
+#endif /* WSOLASTRETCHER_HPP_ */